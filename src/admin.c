@@ -284,7 +284,7 @@ void admin_send_response (xmlDocPtr doc : itype(_Ptr<xmlDoc>), client_t *client
 	ret = util_http_build_header(client->refbuf->data, buf_len, 0,
 	                             0, 200, NULL,
 				     "text/xml", "utf-8",
-				     NULL, NULL);
+				     NULL, NULL, client);
         if (ret == -1) {
             ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
             client_send_500(client, "Header generation failed.");
@@ -299,7 +299,7 @@ void admin_send_response (xmlDocPtr doc : itype(_Ptr<xmlDoc>), client_t *client
                 ret = util_http_build_header(client->refbuf->data, buf_len, 0,
                                              0, 200, NULL,
                                              "text/xml", "utf-8",
-                                             NULL, NULL);
+                                             NULL, NULL, client);
                 if (ret == -1) {
                     ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
                     client_send_500(client, "Header generation failed.");
@@ -611,7 +611,7 @@ static void html_success(_Ptr<client_t> client, _Nt_array_ptr<char> message)
     ret = util_http_build_header(client->refbuf->data, PER_CLIENT_REFBUF_SIZE, 0,
                                  0, 200, NULL,
 				 "text/html", "utf-8",
-				 "", NULL);
+				 "", NULL, NULL);
 
     if (ret == -1 || ret >= PER_CLIENT_REFBUF_SIZE) {
         ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
@@ -755,7 +755,7 @@ static void command_buildm3u(_Ptr<client_t> client, _Nt_array_ptr<const char> mo
     ret = util_http_build_header(client->refbuf->data, PER_CLIENT_REFBUF_SIZE, 0,
                                  0, 200, NULL,
 				 "audio/x-mpegurl", NULL,
-				 NULL, NULL);
+				 NULL, NULL, NULL);
 
     if (ret == -1 || ret >= (PER_CLIENT_REFBUF_SIZE - 512)) { /* we want at least 512 Byte left for data */
         ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
@@ -1094,7 +1094,7 @@ static void command_list_mounts(_Ptr<client_t> client, int response)
         ssize_t ret = util_http_build_header(client->refbuf->data, PER_CLIENT_REFBUF_SIZE, 0,
 	                       0, 200, NULL,
 			       "text/plain", "utf-8",
-			       "", NULL);
+			       "", NULL, NULL);
 
         if (ret == -1 || ret >= PER_CLIENT_REFBUF_SIZE) {
             ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
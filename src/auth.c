@@ -440,6 +440,7 @@ static int add_listener_to_source (_Ptr<source_t> source, _Ptr<client_t> client)
     avl_tree_wlock (source->pending_tree);
     avl_insert<client_t> (source->pending_tree, client);
     avl_tree_unlock (source->pending_tree);
+    source_kick (source);
 
     if (source->running == 0 && source->on_demand)
     {
@@ -462,6 +463,14 @@ static int add_authenticated_listener (_Nt_array_ptr<const char> mount, _Ptr<mou
 
     client->authenticated = 1;
 
+    /* metrics are written directly from the stats, no stylesheet involved */
+    if (strcmp (mount, "/metrics") == 0)
+    {
+        ICECAST_LOG_DEBUG("Stats request, sending metrics");
+        stats_send_metrics (client);
+        return 0;
+    }
+
     /* Here we are parsing the URI request to see if the extension is .xsl, if
      * so, then process this request as an XSLT request
      */
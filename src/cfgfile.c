@@ -60,6 +60,8 @@
 #define CONFIG_DEFAULT_GROUP NULL
 #define CONFIG_MASTER_UPDATE_INTERVAL 120
 #define CONFIG_YP_URL_TIMEOUT 10
+#define CONFIG_DEFAULT_SSL_SESSION_CACHE 20480
+#define CONFIG_DEFAULT_SSL_SESSION_TIMEOUT 3600
 #define CONFIG_DEFAULT_CIPHER_LIST "ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-AES256-GCM-SHA384:DHE-RSA-AES128-GCM-SHA256:DHE-DSS-AES128-GCM-SHA256:kEDH+AESGCM:ECDHE-RSA-AES128-SHA256:ECDHE-ECDSA-AES128-SHA256:ECDHE-RSA-AES128-SHA:ECDHE-ECDSA-AES128-SHA:ECDHE-RSA-AES256-SHA384:ECDHE-ECDSA-AES256-SHA384:ECDHE-RSA-AES256-SHA:ECDHE-ECDSA-AES256-SHA:DHE-RSA-AES128-SHA256:DHE-RSA-AES128-SHA:DHE-DSS-AES128-SHA256:DHE-RSA-AES256-SHA256:DHE-DSS-AES256-SHA:DHE-RSA-AES256-SHA:ECDHE-RSA-DES-CBC3-SHA:ECDHE-ECDSA-DES-CBC3-SHA:AES128-GCM-SHA256:AES256-GCM-SHA384:AES128-SHA256:AES256-SHA256:AES128-SHA:AES256-SHA:AES:DES-CBC3-SHA:HIGH:!aNULL:!eNULL:!EXPORT:!DES:!RC4:!MD5:!PSK:!aECDH:!EDH-DSS-DES-CBC3-SHA:!EDH-RSA-DES-CBC3-SHA:!KRB5-DES-CBC3-SHA"
 
 #ifndef _WIN32
@@ -443,6 +445,8 @@ static void _set_defaults(_Ptr<ice_config_t> configuration)
     configuration->base_dir = (_Nt_array_ptr<char>)xmlCharStrdup (CONFIG_DEFAULT_BASE_DIR);
     configuration->log_dir = (_Nt_array_ptr<char>)xmlCharStrdup (CONFIG_DEFAULT_LOG_DIR);
     configuration->cipher_list = (_Nt_array_ptr<char>)xmlCharStrdup (CONFIG_DEFAULT_CIPHER_LIST);
+    configuration->ssl_session_cache = CONFIG_DEFAULT_SSL_SESSION_CACHE;
+    configuration->ssl_session_timeout = CONFIG_DEFAULT_SSL_SESSION_TIMEOUT;
     configuration->webroot_dir = (_Nt_array_ptr<char>)xmlCharStrdup (CONFIG_DEFAULT_WEBROOT_DIR);
     configuration->adminroot_dir = (_Nt_array_ptr<char>)xmlCharStrdup (CONFIG_DEFAULT_ADMINROOT_DIR);
     configuration->playlist_log = (_Nt_array_ptr<char>)xmlCharStrdup (CONFIG_DEFAULT_PLAYLIST_LOG);
@@ -618,6 +622,20 @@ static void _parse_limits(xmlDocPtr doc, xmlNodePtr node, _Ptr<ice_config_t> con
             tmp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
             configuration->threadpool_size = atoi(tmp);
             if (tmp) xmlSafeFree(tmp);
+        } else if (xmlStrcmp (node->name, XMLSTR("source-workers")) == 0) {
+            tmp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            if (tmp && strcmp (tmp, "auto") == 0)
+                configuration->source_workers = -1;
+            else
+                configuration->source_workers = atoi(tmp);
+            if (tmp) xmlSafeFree(tmp);
+        } else if (xmlStrcmp (node->name, XMLSTR("acceptor-threads")) == 0) {
+            tmp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            if (tmp && strcmp (tmp, "auto") == 0)
+                configuration->acceptor_threads = -1;
+            else
+                configuration->acceptor_threads = atoi(tmp);
+            if (tmp) xmlSafeFree(tmp);
         } else if (xmlStrcmp (node->name, XMLSTR("client-timeout")) == 0) {
             tmp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
             configuration->client_timeout = atoi(tmp);
@@ -758,6 +776,11 @@ static void _parse_mount(xmlDocPtr doc, xmlNodePtr node, _Ptr<ice_config_t> conf
             mount->max_listener_duration = atoi(tmp);
             if(tmp) xmlSafeFree(tmp);
         }
+        else if (xmlStrcmp (node->name, XMLSTR("listener-threads")) == 0) {
+            tmp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            mount->listener_threads = atoi(tmp);
+            if(tmp) xmlSafeFree(tmp);
+        }
         else if (xmlStrcmp (node->name, XMLSTR("queue-size")) == 0) {
             tmp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
             mount->queue_size_limit = atoi (tmp);
@@ -1160,6 +1183,24 @@ _Ptr<aliases> last = ((void *)0);
         } else if (xmlStrcmp (node->name, XMLSTR("ssl-allowed-ciphers")) == 0) {
             if (configuration->cipher_list) xmlSafeFree(configuration->cipher_list);
             configuration->cipher_list = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+        } else if (xmlStrcmp (node->name, XMLSTR("ssl-session-cache")) == 0) {
+            temp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            if (temp) {
+                configuration->ssl_session_cache = atoi(temp);
+                xmlSafeFree(temp);
+            }
+        } else if (xmlStrcmp (node->name, XMLSTR("ssl-session-timeout")) == 0) {
+            temp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            if (temp) {
+                configuration->ssl_session_timeout = atoi(temp);
+                xmlSafeFree(temp);
+            }
+        } else if (xmlStrcmp (node->name, XMLSTR("ssl-ktls")) == 0) {
+            temp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            if (temp) {
+                configuration->ssl_ktls = atoi(temp);
+                xmlSafeFree(temp);
+            }
         } else if (xmlStrcmp (node->name, XMLSTR("webroot")) == 0) {
             if (!(temp = (_Nt_array_ptr<char>)xmlNodeListGetString(doc, node->xmlChildrenNode, 1))) {
                 ICECAST_LOG_WARN("<webroot> must not be empty.");
@@ -1394,6 +1435,8 @@ static void merge_mounts(_Ptr<mount_proxy> dst, _Ptr<mount_proxy> src) {
     	dst->on_disconnect = (_Nt_array_ptr<char>)xmlStrdup((_Nt_array_ptr<xmlChar>)src->on_disconnect);
     if (!dst->max_listener_duration)
     	dst->max_listener_duration = src->max_listener_duration;
+    if (!dst->listener_threads)
+    	dst->listener_threads = src->listener_threads;
     if (!dst->stream_name)
     	dst->stream_name = (_Nt_array_ptr<char>)xmlStrdup((_Nt_array_ptr<xmlChar>)src->stream_name);
     if (!dst->stream_description)
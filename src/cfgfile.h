@@ -107,6 +107,8 @@ typedef struct _mount_proxy {
     char *on_connect : itype(_Nt_array_ptr<char>);
     char *on_disconnect : itype(_Nt_array_ptr<char>);
     unsigned int max_listener_duration;
+    int listener_threads; /* number of threads sending to listeners, 0 or 1
+                             to send from the source thread only */
 
     char *stream_name : itype(_Nt_array_ptr<char>);
     char *stream_description : itype(_Nt_array_ptr<char>);
@@ -148,6 +150,8 @@ typedef struct ice_config_tag {
     int source_limit;
     unsigned int queue_size_limit;
     int threadpool_size;
+    int source_workers;     /* 0 for a thread per source, -1 for one per core */
+    int acceptor_threads;   /* 0 or 1 for a single accept loop, -1 for one per core */
     unsigned int burst_size;
     int client_timeout;
     int header_timeout;
@@ -193,6 +197,9 @@ typedef struct ice_config_tag {
     char *allowfile : itype(_Nt_array_ptr<char>);
     char *cert_file : itype(_Nt_array_ptr<char>);
     char *cipher_list : itype(_Nt_array_ptr<char>);
+    int ssl_session_cache;      /* sessions held for resumption, 0 disables */
+    int ssl_session_timeout;    /* seconds, also the ticket key lifetime */
+    int ssl_ktls;               /* let the kernel encrypt once negotiated */
     char *webroot_dir : itype(_Nt_array_ptr<char>);
     char *adminroot_dir : itype(_Nt_array_ptr<char>);
     aliases *aliases : itype(_Ptr<aliases>);
@@ -96,6 +96,11 @@ void client_destroy(_Ptr<client_t> client)
         refbuf_release (client->refbuf);
         client->refbuf = NULL;
     }
+    if (client->pipelined)
+    {
+        refbuf_release (client->pipelined);
+        client->pipelined = NULL;
+    }
 
     if (auth_release_listener (client))
         return;
@@ -127,6 +132,50 @@ void client_destroy(_Ptr<client_t> client)
     free<client_t>(client);
 }
 
+/* the response has been written out. If the headers promised to keep the
+ * connection then reset the client and hand it back to wait for the next
+ * request, otherwise it is done with.
+ */
+void client_finish_response(_Ptr<client_t> client)
+{
+    if (client->keepalive != CLIENT_KEEPALIVE_ACTIVE || client->con->error ||
+            client->auth || global.running != ICECAST_RUNNING)
+    {
+        client_destroy (client);
+        return;
+    }
+
+    if (client->respcode && client->parser)
+        logging_access(client);
+    if (client->parser)
+        httpp_destroy(client->parser);
+    client->parser = NULL;
+    client_set_queue (client, NULL);
+
+    if (client->free_client_data) _Checked {
+        client->free_client_data (client);
+    }
+    client->free_client_data = NULL;
+
+    free<char>(client->username);
+    free<char>(client->password);
+    client->username = client->password = NULL;
+
+    client->respcode = 0;
+    client->authenticated = 0;
+    client->intro_offset = 0;
+    client->keepalive = CLIENT_KEEPALIVE_NONE;
+    client->write_to_client = format_generic_write_to_client;
+    client->check_buffer = NULL;
+    client->poll_state = CLIENT_POLL_NONE;
+
+    /* the header timeout now limits how long the connection can sit idle */
+    client->con->sent_bytes = 0;
+    client->con->con_time = time(NULL);
+
+    connection_requeue (client);
+}
+
 void client_free_format(client_t *client : itype(_Ptr<client_t>)) { 
   free<void>(client->format_data); 
   client->format_data = NULL;
@@ -200,11 +249,21 @@ int client_read_bytes (client_t *client : itype(_Ptr<client_t>), void *buf : ity
 void client_send_error(client_t *client : itype(_Ptr<client_t>), int status, int plain, const char *message : itype(_Nt_array_ptr<const char>) count(0))
 {
     ssize_t ret;
+    char body _Nt_checked[1024];
+
+    /* the whole body goes in as the datablock so it can be measured */
+    if (!plain)
+    {
+        snprintf(body, sizeof(body),
+                 "<html><head><title>Error %i</title></head><body><b>%i - %s</b></body></html>\r\n",
+                 status, status, message);
+        message = body;
+    }
 
     ret = util_http_build_header(client->refbuf->data, PER_CLIENT_REFBUF_SIZE, 0,
                                  0, status, NULL,
                                  plain ? "text/plain" : "text/html", "utf-8",
-                                 plain ? message : "", NULL);
+                                 message, NULL, client);
 
     if (ret == -1 || ret >= PER_CLIENT_REFBUF_SIZE) {
         ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
@@ -212,11 +271,6 @@ void client_send_error(client_t *client : itype(_Ptr<client_t>), int status, int
         return;
     }
 
-    if (!plain)
-        snprintf(client->refbuf->data + ret, PER_CLIENT_REFBUF_SIZE - ret,
-                 "<html><head><title>Error %i</title></head><body><b>%i - %s</b></body></html>\r\n",
-                 status, status, message);
-
     client->respcode = status;
     int len = strlen(client->refbuf->data);
     client->refbuf->data = _Assume_bounds_cast<_Nt_array_ptr<const char>>(client->refbuf->data, count(len)), client->refbuf->len = len;
@@ -277,6 +331,25 @@ _Itype_for_any(T) int client_send_bytes(client_t *client : itype(_Ptr<client_t>)
     return ret;
 }
 
+/* gathered write of several buffers, connections without vectored writes
+ * just get the first buffer sent */
+int client_send_iov (client_t *client : itype(_Ptr<client_t>), const struct iovec *iov : itype(_Array_ptr<const struct iovec>) count(count), int count)
+{
+    int ret;
+
+    if (count <= 0)
+        return 0;
+    if (client->con->sendv == NULL)
+        return client_send_bytes<const char> (client, iov[0].iov_base, iov[0].iov_len);
+
+    ret = client->con->sendv (client->con, iov, count);
+
+    if (client->con->error)
+        ICECAST_LOG_DEBUG("Client connection died");
+
+    return ret;
+}
+
 void client_set_queue (_Ptr<client_t> client, refbuf_t *refbuf : itype(_Ptr<refbuf_t>))
 {
     _Ptr<refbuf_t> to_release = client->refbuf;
@@ -289,3 +362,25 @@ void client_set_queue (_Ptr<client_t> client, refbuf_t *refbuf : itype(_Ptr<refb
         refbuf_release (to_release);
 }
 
+
+/* Once a listener is streaming, only a few request details are still used,
+ * by the access log, listener auth release and the admin listings. Swap
+ * the parser for a compact copy holding just those.
+ */
+void client_shrink_request (_Ptr<client_t> client)
+{
+    _Nt_array_ptr<const char> keep _Checked[] = {
+        HTTPP_VAR_REQ_TYPE, HTTPP_VAR_URI, HTTPP_VAR_RAWURI,
+        HTTPP_VAR_PROTOCOL, HTTPP_VAR_VERSION, "user-agent", "referer"
+    };
+    _Ptr<http_parser_t> parser = NULL;
+
+    if (client->parser == NULL)
+        return;
+    parser = httpp_retain (client->parser, keep, sizeof (keep) / sizeof (keep[0]));
+    if (parser == NULL)
+        return;
+    httpp_destroy (client->parser);
+    client->parser = parser;
+}
+
@@ -66,8 +66,33 @@ typedef struct _client_tag
     /* function to check if refbuf needs updating */
     int ((*check_buffer)(struct source_tag *source, struct _client_tag *client)) : itype(_Ptr<int (_Ptr<struct source_tag> source, _Ptr<struct _client_tag> client)>);
 
+    /* socket write readiness as tracked by the source, CLIENT_POLL_* */
+    int poll_state;
+
+    /* the source listener list the client is on and its links in there */
+    _Ptr<struct source_sendlist_tag> send_list;
+    _Ptr<struct _client_tag> send_next;
+    _Ptr<_Ptr<struct _client_tag>> send_prev;
+
+    /* persistent connection state, CLIENT_KEEPALIVE_* */
+    int keepalive;
+
+    /* most a gathered write may send on this call, 0 for no extra limit */
+    unsigned int write_limit;
+
+    /* request bytes read beyond the current request, for the next one */
+    refbuf_t *pipelined : itype(_Ptr<refbuf_t>);
+
 } client_t;
 
+#define CLIENT_POLL_NONE        0   /* not watched, always try to write */
+#define CLIENT_POLL_READY       1   /* watched and writable */
+#define CLIENT_POLL_BLOCKED     2   /* watched, send buffer full */
+
+#define CLIENT_KEEPALIVE_NONE   0   /* close once the response is sent */
+#define CLIENT_KEEPALIVE_ALLOWED 1  /* request allows the connection to stay */
+#define CLIENT_KEEPALIVE_ACTIVE 2   /* response headers said it would stay */
+
 _Itype_for_any(T)
 void client_set_format(client_t *client : itype(_Ptr<client_t>), void *format_data : itype(_Ptr<T>));
 
@@ -78,6 +103,7 @@ void client_free_format(client_t *client : itype(_Ptr<client_t>));
 
 int client_create (client_t **c_ptr : itype(_Ptr<_Ptr<client_t>>), connection_t *con : itype(_Ptr<connection_t>), http_parser_t *parser : itype(_Ptr<http_parser_t>));
 void client_destroy(_Ptr<client_t> client);
+void client_finish_response(_Ptr<client_t> client);
 void client_send_100(client_t *client : itype(_Ptr<client_t>));
 void client_send_404(client_t *client : itype(_Ptr<client_t>), const char *message : itype(_Nt_array_ptr<const char>) count(0));
 void client_send_401(client_t *client : itype(_Ptr<client_t>));
@@ -85,8 +111,10 @@ void client_send_403(client_t *client : itype(_Ptr<client_t>), const char *messa
 void client_send_400(client_t *client : itype(_Ptr<client_t>), const char *message : itype(_Nt_array_ptr<const char>) count(0));
 void client_send_500(client_t *client : itype(_Ptr<client_t>), const char *message : itype(_Nt_array_ptr<const char>) count(20));
 _Itype_for_any(T) int client_send_bytes(client_t *client : itype(_Ptr<client_t>), const void *buf : itype(_Array_ptr<T>) byte_count(len), unsigned len);
+int client_send_iov (client_t *client : itype(_Ptr<client_t>), const struct iovec *iov : itype(_Array_ptr<const struct iovec>) count(count), int count);
 int client_read_bytes (client_t *client : itype(_Ptr<client_t>), void *buf : itype(_Array_ptr<void>) byte_count(len), unsigned len);
 void client_set_queue (_Ptr<client_t> client, refbuf_t *refbuf : itype(_Ptr<refbuf_t>));
+void client_shrink_request (_Ptr<client_t> client);
 int client_check_source_auth (client_t *client : itype(_Ptr<client_t>), const char *mount : itype(_Nt_array_ptr<const char>));
 void client_send_error(client_t *client : itype(_Ptr<client_t>), int status, int plain, const char *message : itype(_Nt_array_ptr<const char>) count(0));
 
@@ -24,12 +24,17 @@
 #ifdef HAVE_POLL
 #include <sys/poll.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #ifndef _WIN32
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 #else
 #include <winsock2.h>
 #define snprintf _snprintf
@@ -37,6 +42,16 @@
 #define strncasecmp strnicmp
 #endif
 
+#ifdef HAVE_OPENSSL
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+#endif
+
 #include "compat.h"
 
 #include "thread/thread.h"
@@ -87,6 +102,9 @@ typedef struct client_queue_tag {
     _Ptr<client_t> client;
     int offset;
     int stream_offset;
+    int scan_offset;    /* bytes already checked for the end of headers */
+    int watched;        /* socket is in the acceptor poll set */
+    int ready;          /* socket may have data to read */
     int shoutcast;
     char *shoutcast_mount;
     _Ptr<struct client_queue_tag> next;
@@ -97,88 +115,114 @@ typedef struct _thread_queue_tag {
     struct _thread_queue_tag *next : itype(_Ptr<struct _thread_queue_tag>);
 } thread_queue_t;
 
+/* A binary radix trie of address prefixes for the ban/allow files. IPv4
+ * addresses are held as IPv4 mapped IPv6 so one trie covers both, and the
+ * nodes live in one array so a list is released in one go. A node covers
+ * the first bits of addr, a terminal node is a listed prefix.
+ */
+typedef struct
+{
+    unsigned char addr _Checked[16];
+    int bits;
+    int terminal;
+    int child[2];       /* node index, or -1 */
+} ip_trie_node_t;
+
+typedef struct
+{
+    _Array_ptr<ip_trie_node_t> nodes : count(size);
+    int size;
+    int count;
+    int root;
+} ip_trie_t;
+
 typedef struct
 {
     char *filename : itype(_Nt_array_ptr<char>);
     time_t file_recheck;
     time_t file_mtime;
-    avl_tree *contents : itype(_Ptr<avl_tree>);
+    ip_trie_t *contents : itype(_Ptr<ip_trie_t>);
 } cache_file_contents;
 
-static spin_t _connection_lock; // protects _current_id, _con_queue, _con_queue_tail
+/* An acceptor accepts new connections and reads their request headers. The
+ * main thread is acceptor 0 and waits on global.serversock, any others have
+ * their own SO_REUSEPORT sockets bound alongside, socks[i] sharing the port
+ * of global.serversock[i] so the listener settings can be found. The queues
+ * are only touched by the owning thread.
+ */
+typedef struct
+{
+    int id;
+    int sock_count;
+    sock_t *socks : itype(_Array_ptr<sock_t>) count(sock_count);
+    client_queue_t *req_queue : itype(_Ptr<client_queue_t>);
+    client_queue_t **req_queue_tail : itype(_Ptr<_Ptr<client_queue_t>>);
+    client_queue_t *con_queue : itype(_Ptr<client_queue_t>);
+    client_queue_t **con_queue_tail : itype(_Ptr<_Ptr<client_queue_t>>);
+    int poll_fd;        /* epoll set of request queue sockets, or -1 */
+    int unwatched;      /* queued requests not in the poll set */
+    time_t last_sweep;
+    thread_type *thread : itype(_Ptr<thread_type>);
+} acceptor_t;
+
+static spin_t _connection_lock; // protects _current_id
 static volatile unsigned long _current_id = 0;
 static int _initialized = 0;
 
-static volatile _Ptr<client_queue_t> _req_queue = NULL; 
-static volatile _Ptr<_Ptr<client_queue_t>> _req_queue_tail = &_req_queue;
-static volatile _Ptr<client_queue_t> _con_queue = NULL;  
-static volatile _Ptr<_Ptr<client_queue_t>> _con_queue_tail = &_con_queue;
+static int _acceptor_count = 0;
+static _Array_ptr<acceptor_t> _acceptors : count(_acceptor_count) = NULL;
+
+/* persistent connections handed back once their response is sent, for any
+ * acceptor to pick up. A byte down the pipe wakes the acceptor poll sets */
+static spin_t _requeue_lock;
+static _Ptr<client_queue_t> _requeue_list = NULL;
+static int _requeue_pipe[2] = { -1, -1 };
 static int ssl_ok;
 #ifdef HAVE_OPENSSL
 static SSL_CTX *ssl_ctx;
+
+/* session ticket keys, [0] seals new tickets and [1] is the one it replaced,
+ * still accepted so tickets survive a rotation */
+#define SSL_TICKET_KEYS 2
+
+typedef struct
+{
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+    time_t created;
+} ssl_ticket_key_t;
+
+static ssl_ticket_key_t ssl_ticket_keys[SSL_TICKET_KEYS];
+static int ssl_ticket_lifetime;
+static mutex_t _ssl_ticket_lock;    // protects the ticket keys
 #endif
 
 /* filtering client connection based on IP */
 static cache_file_contents banned_ip, allowed_ip;
+static mutex_t _ip_file_lock;       // protects the filenames and file times
+static rwlock_t _ip_filter_lock;    // protects the contents, swapped on reload
 
 rwlock_t _source_shutdown_rwlock;
 
-static void _handle_connection(void);
-
-typedef struct { 
-  char *str : itype(_Nt_array_ptr<char>);
-} StringContainer;
-
-static _Ptr<StringContainer> box(_Nt_array_ptr<char> str) { 
-  _Ptr<StringContainer> b = malloc<StringContainer>(sizeof *b); 
-  b->str = str;
-  return b;
-}
-
-static int avl_box_insert(_Ptr<avl_tree> t, _Nt_array_ptr<char> s) { 
-  _Ptr<StringContainer> b = box(s); 
-  return avl_insert<StringContainer>(t, b);
-}
-
-static _Nt_array_ptr<char> avl_box_get_by_key(_Ptr<avl_tree> t, _Nt_array_ptr<char> key) { 
-  _Ptr<StringContainer> box = malloc<StringContainer>(sizeof(StringContainer)); 
-  box->str = key; 
-  _Ptr<StringContainer> resultBox = NULL;
-
-  int status = avl_get_by_key<StringContainer>(t, box, &resultBox);
-  return resultBox->str;
-}
-
-static int compare_ip (void *arg, void *a, void *b)
-{
-    _Nt_array_ptr<const char> ip = ((const StringContainer *)a)->str;
-    _Nt_array_ptr<const char> pattern = ((const StringContainer *)b)->str;
-
-    return strcmp (pattern, ip);
-}
-
-
-static int free_filtered_ip(_Ptr<StringContainer> x)
-{
-  _Ptr<StringContainer> b = x; 
-  free<char>(b->str);
-  free<StringContainer>(b);
-    return 1;
-}
-
+static void _handle_connection(_Ptr<acceptor_t> acceptor);
+static void _take_requeued (_Ptr<acceptor_t> acceptor, int woken);
+static void ip_trie_free (_Ptr<ip_trie_t> trie);
 
 void connection_initialize(void)
 {
     if (_initialized) return;
     
     thread_spin_create (&_connection_lock);
+    thread_spin_create (&_requeue_lock);
     thread_mutex_create(&move_clients_mutex);
     thread_rwlock_create(&_source_shutdown_rwlock);
     thread_cond_create(&global.shutdown_cond);
-    _req_queue = NULL;
-    _req_queue_tail = &_req_queue;
-    _con_queue = NULL;
-    _con_queue_tail = &_con_queue;
+    thread_mutex_create(&_ip_file_lock);
+    thread_rwlock_create(&_ip_filter_lock);
+#ifdef HAVE_OPENSSL
+    thread_mutex_create(&_ssl_ticket_lock);
+#endif
 
     banned_ip.contents = NULL;
     banned_ip.file_mtime = 0;
@@ -186,6 +230,16 @@ void connection_initialize(void)
     allowed_ip.contents = NULL;
     allowed_ip.file_mtime = 0;
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (pipe (_requeue_pipe) == 0)
+    {
+        sock_set_blocking (_requeue_pipe[0], 0);
+        sock_set_blocking (_requeue_pipe[1], 0);
+    }
+    else
+        _requeue_pipe[0] = _requeue_pipe[1] = -1;
+#endif
+
     _initialized = 1;
 }
 
@@ -196,13 +250,37 @@ void connection_shutdown(void)
 #ifdef HAVE_OPENSSL
     SSL_CTX_free (ssl_ctx);
 #endif
-    if (banned_ip.contents)  avl_tree_free<StringContainer>(banned_ip.contents, free_filtered_ip);
-    if (allowed_ip.contents) avl_tree_free<StringContainer>(allowed_ip.contents, free_filtered_ip);
+    ip_trie_free (banned_ip.contents);
+    ip_trie_free (allowed_ip.contents);
+    banned_ip.contents = allowed_ip.contents = NULL;
+
+    while (_requeue_list)
+    {
+        _Ptr<client_queue_t> node = _requeue_list;
+
+        _requeue_list = node->next;
+        client_destroy (node->client);
+        free<char> (node->shoutcast_mount);
+        free<client_queue_t> (node);
+    }
+    if (_requeue_pipe[0] >= 0)
+    {
+        close (_requeue_pipe[0]);
+        close (_requeue_pipe[1]);
+        _requeue_pipe[0] = _requeue_pipe[1] = -1;
+    }
  
     thread_cond_destroy(&global.shutdown_cond);
     thread_rwlock_destroy(&_source_shutdown_rwlock);
     thread_spin_destroy (&_connection_lock);
+    thread_spin_destroy (&_requeue_lock);
     thread_mutex_destroy(&move_clients_mutex);
+    thread_mutex_destroy(&_ip_file_lock);
+    thread_rwlock_destroy(&_ip_filter_lock);
+#ifdef HAVE_OPENSSL
+    OPENSSL_cleanse (ssl_ticket_keys, sizeof (ssl_ticket_keys));
+    thread_mutex_destroy(&_ssl_ticket_lock);
+#endif
 
     _initialized = 0;
 }
@@ -220,6 +298,134 @@ static unsigned long _next_connection_id(void)
 
 
 #ifdef HAVE_OPENSSL
+/* replace the ticket sealing key, keeping the current one for unsealing.
+ * Called with the ticket lock held */
+static void ssl_ticket_rotate (time_t now)
+{
+    ssl_ticket_key_t *key = &ssl_ticket_keys[0];
+
+    memmove (&ssl_ticket_keys[1], key, sizeof (*key) * (SSL_TICKET_KEYS-1));
+    if (RAND_bytes (key->name, sizeof (key->name)) != 1 ||
+            RAND_bytes (key->aes_key, sizeof (key->aes_key)) != 1 ||
+            RAND_bytes (key->hmac_key, sizeof (key->hmac_key)) != 1)
+    {
+        /* leave no usable key rather than a predictable one */
+        ICECAST_LOG_ERROR("unable to generate session ticket key");
+        memset (key, 0, sizeof (*key));
+        return;
+    }
+    key->created = now;
+}
+
+
+/* copy out the key to seal a new ticket, or the key matching the name of a
+ * presented ticket. Returns 0 if there is none, 1 to use it and 2 if the
+ * ticket should be replaced as it was sealed by the previous key.
+ */
+static int ssl_ticket_key (unsigned char *name, int enc, ssl_ticket_key_t *found)
+{
+    time_t now = time (NULL);
+    int i, ret = 0;
+
+    thread_mutex_lock (&_ssl_ticket_lock);
+    if (now - ssl_ticket_keys[0].created >= ssl_ticket_lifetime)
+        ssl_ticket_rotate (now);
+    for (i = 0; i < SSL_TICKET_KEYS; i++)
+    {
+        ssl_ticket_key_t *key = &ssl_ticket_keys[i];
+
+        if (key->created == 0)
+            continue;
+        if (enc)
+            memcpy (name, key->name, sizeof (key->name));
+        else if (memcmp (name, key->name, sizeof (key->name)))
+            continue;
+        *found = *key;
+        ret = i ? 2 : 1;
+        break;
+    }
+    thread_mutex_unlock (&_ssl_ticket_lock);
+    return enc && ret != 1 ? 0 : ret;
+}
+
+
+/* called by openssl to set up the cipher and mac for sealing (enc) or
+ * unsealing a session ticket */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ssl_ticket_key_cb (SSL *ssl, unsigned char *name, unsigned char *iv,
+        EVP_CIPHER_CTX *ectx, EVP_MAC_CTX *hctx, int enc)
+#else
+static int ssl_ticket_key_cb (SSL *ssl, unsigned char *name, unsigned char *iv,
+        EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
+#endif
+{
+    ssl_ticket_key_t key;
+    int ret;
+
+    if (enc && RAND_bytes (iv, EVP_CIPHER_iv_length (EVP_aes_256_cbc())) != 1)
+        return -1;
+    ret = ssl_ticket_key (name, enc, &key);
+    if (ret == 0)
+        return 0;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    {
+        OSSL_PARAM params[2];
+
+        params[0] = OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST, (char *)"SHA256", 0);
+        params[1] = OSSL_PARAM_construct_end ();
+        if (EVP_MAC_init (hctx, key.hmac_key, sizeof (key.hmac_key), params) != 1)
+            ret = -1;
+    }
+#else
+    if (HMAC_Init_ex (hctx, key.hmac_key, sizeof (key.hmac_key), EVP_sha256(), NULL) != 1)
+        ret = -1;
+#endif
+    if (ret > 0)
+    {
+        if (enc)
+        {
+            if (EVP_EncryptInit_ex (ectx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1)
+                ret = -1;
+        }
+        else if (EVP_DecryptInit_ex (ectx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1)
+            ret = -1;
+    }
+    OPENSSL_cleanse (&key, sizeof (key));
+    return ret;
+}
+
+
+/* allow returning clients to skip the full handshake, from the session
+ * cache by id or from a ticket they hold */
+static void ssl_setup_resumption (ice_config_t *config)
+{
+    if (config->ssl_session_cache > 0)
+    {
+        SSL_CTX_set_session_cache_mode (ssl_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size (ssl_ctx, config->ssl_session_cache);
+        SSL_CTX_set_session_id_context (ssl_ctx, (const unsigned char *)"icecast", 7);
+    }
+    else
+        SSL_CTX_set_session_cache_mode (ssl_ctx, SSL_SESS_CACHE_OFF);
+
+    if (config->ssl_session_timeout > 0)
+    {
+        SSL_CTX_set_timeout (ssl_ctx, config->ssl_session_timeout);
+        thread_mutex_lock (&_ssl_ticket_lock);
+        ssl_ticket_lifetime = config->ssl_session_timeout;
+        memset (ssl_ticket_keys, 0, sizeof (ssl_ticket_keys));
+        thread_mutex_unlock (&_ssl_ticket_lock);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb (ssl_ctx, ssl_ticket_key_cb);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb (ssl_ctx, ssl_ticket_key_cb);
+#endif
+    }
+    else
+        SSL_CTX_set_options (ssl_ctx, SSL_OP_NO_TICKET);
+}
+
+
 static void get_ssl_certificate (ice_config_t *config)
 {
 #if OPENSSL_VERSION_NUMBER < 0x1000114fL
@@ -241,6 +447,14 @@ static void get_ssl_certificate (ice_config_t *config)
 #else
     SSL_CTX_set_options (ssl_ctx, ssl_opts|SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3);
 #endif
+    if (config->ssl_ktls)
+    {
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+        SSL_CTX_set_options (ssl_ctx, SSL_OP_ENABLE_KTLS);
+#else
+        ICECAST_LOG_WARN("kernel TLS requested but not supported by this OpenSSL");
+#endif
+    }
 
     do
     {
@@ -265,6 +479,7 @@ static void get_ssl_certificate (ice_config_t *config)
         { 
             ICECAST_LOG_WARN("Invalid cipher list: %s", config->cipher_list); 
         } 
+        ssl_setup_resumption (config);
         ssl_ok = 1;
         ICECAST_LOG_INFO("SSL certificate found at %s", config->cert_file);
         ICECAST_LOG_INFO("SSL using ciphers %s", config->cipher_list); 
@@ -312,15 +527,34 @@ static int connection_send_ssl (connection_t *con, const void *buf, size_t len)
         con->sent_bytes += bytes;
     return bytes;
 }
+#endif /* HAVE_OPENSSL */
+
+/* fill in the session resumption counters, returns 0 when SSL is not in
+ * use */
+int connection_get_ssl_stats (connection_ssl_stats_t *stats : itype(_Ptr<connection_ssl_stats_t>))
+{
+    memset (stats, 0, sizeof (*stats));
+#ifdef HAVE_OPENSSL
+    if (ssl_ok == 0)
+        return 0;
+    stats->hits = SSL_CTX_sess_hits (ssl_ctx);
+    stats->misses = SSL_CTX_sess_misses (ssl_ctx);
+    stats->timeouts = SSL_CTX_sess_timeouts (ssl_ctx);
+    stats->cached = SSL_CTX_sess_number (ssl_ctx);
+    return 1;
 #else
+    return 0;
+#endif
+}
 
+#ifndef HAVE_OPENSSL
 /* SSL not compiled in, so at least log it */
 static void get_ssl_certificate (_Ptr<ice_config_t> config)
 {
     ssl_ok = 0;
     ICECAST_LOG_INFO("No SSL capability");
 }
-#endif /* HAVE_OPENSSL */
+#endif
 
 
 /* handlers (default) for reading and writing a connection_t, no encrpytion
@@ -349,37 +583,225 @@ static int connection_send(_Ptr<connection_t> con, _Array_ptr<void> buf : byte_c
     return bytes;
 }
 
+static int connection_sendv(_Ptr<connection_t> con, _Array_ptr<const struct iovec> iov : count(count), int count)
+{
+    int bytes = sock_writev (con->sock, iov, count);
+    if (bytes < 0)
+    {
+        if (!sock_recoverable (sock_error()))
+            con->error = 1;
+    }
+    else
+        con->sent_bytes += bytes;
+    return bytes;
+}
+
 
-/* function to handle the re-populating of the avl tree containing IP addresses
- * for deciding whether a connection of an incoming request is to be dropped.
+/* parse an address, with an optional /prefix when bits is given, into the
+ * IPv6 form used by the trie. IPv4 is mapped to ::ffff:a.b.c.d
  */
-static void recheck_ip_file (_Ptr<cache_file_contents> cache)
+static int ip_parse (_Nt_array_ptr<const char> str, _Array_ptr<unsigned char> addr : count(16), _Ptr<int> bits)
 {
-    time_t now = time(NULL);
-    if (now >= cache->file_recheck)
+    char buf _Nt_checked[INET6_ADDRSTRLEN];
+    size_t slen = strlen (str) _Where str : bounds(str, str + slen);
+    _Nt_array_ptr<const char> slash = bits ? strchr (str, '/') : NULL;
+    size_t len = slash ? (size_t)(slash - str) : slen;
+    struct in_addr v4;
+    int offset, max, ret;
+
+    if (len >= sizeof (buf) || len > slen)
+        return -1;
+    memcpy<char> (buf, str, len);
+    buf [len] = '\0';
+    _Unchecked {
+        ret = inet_pton (AF_INET, (char *)buf, &v4);
+    }
+    if (ret == 1)
     {
-        struct stat file_stat;
-        _Ptr<FILE> file = NULL;
-        int count = 0;
-        _Ptr<avl_tree> new_ips = ((void *)0);
-        char line _Nt_checked[MAX_LINE_LEN];
+        memset (addr, 0, 10);
+        addr[10] = addr[11] = 0xff;
+        memcpy (addr + 12, &v4, 4);
+        offset = 96, max = 32;
+    }
+    else
+    {
+        _Unchecked {
+            ret = inet_pton (AF_INET6, (char *)buf, (unsigned char *)addr);
+        }
+        if (ret != 1)
+            return -1;
+        offset = 0, max = 128;
+    }
+    if (bits)
+    {
+        long prefix = max;
 
-        cache->file_recheck = now + 10;
-        if (cache->filename == NULL)
+        if (slash)
         {
-            if (cache->contents)
-            {
-                avl_tree_free<StringContainer>(cache->contents, free_filtered_ip);
-                cache->contents = NULL;
-            }
-            return;
+            _Nt_array_ptr<char> end = NULL;
+
+            prefix = strtol (slash + 1, &end, 10);
+            if (end == slash + 1 || *end || prefix < 0 || prefix > max)
+                return -1;
         }
+        *bits = offset + (int)prefix;
+    }
+    return 0;
+}
+
+static int ip_bit (_Array_ptr<const unsigned char> addr : count(16), int bit)
+{
+    return (addr [bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* number of leading bits, up to max, that a and b share */
+static int ip_common_bits (_Array_ptr<const unsigned char> a : count(16), _Array_ptr<const unsigned char> b : count(16), int max)
+{
+    int bit = 0;
+
+    while (bit + 8 <= max && a [bit >> 3] == b [bit >> 3])
+        bit += 8;
+    while (bit < max && ip_bit (a, bit) == ip_bit (b, bit))
+        bit++;
+    return bit;
+}
+
+static _Ptr<ip_trie_t> ip_trie_new (void)
+{
+    _Ptr<ip_trie_t> trie = calloc<ip_trie_t> (1, sizeof (ip_trie_t));
+
+    if (trie)
+        trie->root = -1;
+    return trie;
+}
+
+static void ip_trie_free (_Ptr<ip_trie_t> trie)
+{
+    if (trie == NULL)
+        return;
+    free<ip_trie_node_t> (trie->nodes);
+    free<ip_trie_t> (trie);
+}
+
+/* returns the index of a new node, nodes may move so indexes are used */
+static int ip_trie_add_node (_Ptr<ip_trie_t> trie, _Array_ptr<const unsigned char> addr : count(16), int bits, int terminal)
+{
+    _Ptr<ip_trie_node_t> node = NULL;
+
+    if (trie->count == trie->size)
+    {
+        int size = trie->size ? trie->size * 2 : 256;
+        _Array_ptr<ip_trie_node_t> nodes : count(size) = realloc<ip_trie_node_t> (trie->nodes, size * sizeof (ip_trie_node_t));
+
+        if (nodes == NULL)
+            return -1;
+        trie->nodes = nodes, trie->size = size;
+    }
+    node = &trie->nodes [trie->count];
+    memcpy<unsigned char> (node->addr, addr, sizeof (node->addr));
+    node->bits = bits;
+    node->terminal = terminal;
+    node->child[0] = node->child[1] = -1;
+    return trie->count++;
+}
+
+static void ip_trie_link (_Ptr<ip_trie_t> trie, int parent, int side, int n)
+{
+    if (parent < 0)
+        trie->root = n;
+    else
+        trie->nodes [parent].child [side] = n;
+}
+
+static int ip_trie_insert (_Ptr<ip_trie_t> trie, _Array_ptr<const unsigned char> addr : count(16), int bits)
+{
+    int parent = -1, side = 0, n = trie->root;
+
+    while (n >= 0)
+    {
+        _Ptr<ip_trie_node_t> node = &trie->nodes [n];
+        int limit = node->bits < bits ? node->bits : bits;
+        int common = ip_common_bits (node->addr, addr, limit);
+
+        if (common < node->bits)
+        {
+            /* the prefixes part inside this node, so put a node for the
+             * shared part above it */
+            int split = ip_trie_add_node (trie, addr, common, common == bits);
+
+            if (split < 0)
+                return -1;
+            node = &trie->nodes [n];
+            trie->nodes [split].child [ip_bit (node->addr, common)] = n;
+            ip_trie_link (trie, parent, side, split);
+            if (common == bits)
+                return 0;
+            parent = split;
+            side = ip_bit (addr, common);
+            break;
+        }
+        if (node->bits == bits)
+        {
+            node->terminal = 1;
+            return 0;
+        }
+        parent = n;
+        side = ip_bit (addr, node->bits);
+        n = node->child [side];
+    }
+    n = ip_trie_add_node (trie, addr, bits, 1);
+    if (n < 0)
+        return -1;
+    ip_trie_link (trie, parent, side, n);
+    return 0;
+}
+
+/* non-zero if addr falls within any listed prefix */
+static int ip_trie_match (_Ptr<ip_trie_t> trie, _Array_ptr<const unsigned char> addr : count(16))
+{
+    int n = trie->root;
+
+    while (n >= 0)
+    {
+        _Ptr<ip_trie_node_t> node = &trie->nodes [n];
+
+        if (ip_common_bits (node->addr, addr, node->bits) < node->bits)
+            return 0;
+        if (node->terminal)
+            return 1;
+        if (node->bits >= 128)
+            return 0;
+        n = node->child [ip_bit (addr, node->bits)];
+    }
+    return 0;
+}
+
+
+/* rebuild the trie of addresses for deciding whether a connection of an
+ * incoming request is to be dropped, if the file has changed. The new trie
+ * is swapped in so lookups only wait for the swap.
+ */
+static void recheck_ip_file (_Ptr<cache_file_contents> cache, int force)
+{
+    time_t now = time(NULL);
+    struct stat file_stat;
+    _Ptr<FILE> file = NULL;
+    int count = 0, lineno = 0;
+    _Ptr<ip_trie_t> new_ips = ((void *)0);
+    _Ptr<ip_trie_t> old_ips = ((void *)0);
+    char line _Nt_checked[MAX_LINE_LEN];
+
+    if (now < cache->file_recheck && force == 0)
+        return;
+    cache->file_recheck = now + 10;
+    if (cache->filename)
+    {
         if (stat (cache->filename, &file_stat) < 0)
         {
             ICECAST_LOG_WARN("failed to check status of \"%s\": %s", cache->filename, strerror(errno));
             return;
         }
-        if (file_stat.st_mtime == cache->file_mtime)
+        if (file_stat.st_mtime == cache->file_mtime && force == 0)
             return; /* common case, no update to file */
 
         cache->file_mtime = file_stat.st_mtime;
@@ -391,38 +813,55 @@ static void recheck_ip_file (_Ptr<cache_file_contents> cache)
             return;
         }
 
-        new_ips = avl_tree_new<StringContainer>(compare_ip, NULL);
-
-        while (get_line (file, line, MAX_LINE_LEN))
+        new_ips = ip_trie_new ();
+        while (new_ips && get_line (file, line, MAX_LINE_LEN))
         {
-            _Nt_array_ptr<char> str = ((void *)0);
+            unsigned char addr _Checked[16];
+            int bits;
+
+            lineno++;
             if(!line[0] || line[0] == '#')
                 continue;
+            if (ip_parse (line, addr, &bits) < 0)
+            {
+                ICECAST_LOG_WARN("invalid address \"%s\" at line %d of \"%s\"", line, lineno, cache->filename);
+                continue;
+            }
+            if (ip_trie_insert (new_ips, addr, bits) < 0)
+                break;
             count++;
-            str = ((_Nt_array_ptr<char> )strdup (line));
-            if (str)
-                avl_box_insert (new_ips, str);
         }
         fclose (file);
         ICECAST_LOG_INFO("%d entries read from file \"%s\"", count, cache->filename);
-
-        if (cache->contents) avl_tree_free<StringContainer>(cache->contents, free_filtered_ip);
-        cache->contents = new_ips;
     }
+    else if (cache->contents == NULL)
+        return;
+
+    thread_rwlock_wlock (&_ip_filter_lock);
+    old_ips = cache->contents;
+    cache->contents = new_ips;
+    thread_rwlock_unlock (&_ip_filter_lock);
+    ip_trie_free (old_ips);
 }
 
 
-/* return 0 if the passed ip address is not to be handled by icecast, non-zero otherwise */
-static int accept_ip_address (_Nt_array_ptr<char> ip)
+/* called periodically away from the accept path to pick up changes to the
+ * ban and allow files */
+void connection_recheck_ip_files (void)
 {
-    _Nt_array_ptr<char> result = NULL;
+    thread_mutex_lock (&_ip_file_lock);
+    recheck_ip_file (&banned_ip, 0);
+    recheck_ip_file (&allowed_ip, 0);
+    thread_mutex_unlock (&_ip_file_lock);
+}
 
-    recheck_ip_file (&banned_ip);
-    recheck_ip_file (&allowed_ip);
 
+/* return 0 if the passed ip address is not to be handled by icecast, non-zero otherwise */
+static int _check_ip_address (_Nt_array_ptr<char> ip, _Array_ptr<const unsigned char> addr : count(16))
+{
     if (banned_ip.contents)
     {
-        if (avl_box_get_by_key (banned_ip.contents, ip) != NULL)
+        if (ip_trie_match (banned_ip.contents, addr))
         {
             ICECAST_LOG_DEBUG("%s is banned", ip);
             return 0;
@@ -430,7 +869,7 @@ static int accept_ip_address (_Nt_array_ptr<char> ip)
     }
     if (allowed_ip.contents)
     {
-        if (avl_box_get_by_key (allowed_ip.contents, ip) != NULL)
+        if (ip_trie_match (allowed_ip.contents, addr))
         {
             ICECAST_LOG_DEBUG("%s is allowed", ip);
             return 1;
@@ -445,6 +884,20 @@ static int accept_ip_address (_Nt_array_ptr<char> ip)
 }
 
 
+static int accept_ip_address (_Nt_array_ptr<char> ip)
+{
+    unsigned char addr _Checked[16];
+    int ret;
+
+    if (ip_parse (ip, addr, NULL) < 0)
+        return 1;
+    thread_rwlock_rlock (&_ip_filter_lock);
+    ret = _check_ip_address (ip, addr);
+    thread_rwlock_unlock (&_ip_filter_lock);
+    return ret;
+}
+
+
 connection_t *connection_create(sock_t sock, sock_t serversock, char *ip : itype(_Nt_array_ptr<char>)) : itype(_Ptr<connection_t>)
 {
     _Ptr<connection_t> con = calloc<connection_t>(1, sizeof *con);
@@ -457,6 +910,7 @@ connection_t *connection_create(sock_t sock, sock_t serversock, char *ip : itype
         con->ip = ip;
         con->read = connection_read;
         con->send = connection_send;
+        con->sendv = connection_sendv;
     }
 
     return con;
@@ -469,70 +923,99 @@ void connection_uses_ssl (connection_t *con : itype(_Ptr<connection_t>))
 #ifdef HAVE_OPENSSL
     con->read = connection_read_ssl;
     con->send = connection_send_ssl;
+    con->sendv = NULL;
     con->ssl = SSL_new (ssl_ctx);
     SSL_set_accept_state (con->ssl);
     SSL_set_fd (con->ssl, con->sock);
 #endif
 }
 
+
+/* once the handshake is over a connection the kernel encrypts for (kTLS)
+ * can be written to like a plain socket, which allows vectored writes and
+ * sendfile. Reads stay with openssl. Where the kernel declined the keys
+ * openssl still does the encryption.
+ */
+static void connection_check_ktls (_Ptr<connection_t> con)
+{
+#if defined(HAVE_OPENSSL) && defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+    if (con->ssl == NULL || con->sendv)
+        return;
+    /* anything openssl still has to write must go first */
+    if (SSL_is_init_finished (con->ssl) == 0 || SSL_want (con->ssl) != SSL_NOTHING)
+        return;
+    if (BIO_get_ktls_send (SSL_get_wbio (con->ssl)))
+    {
+        con->send = connection_send;
+        con->sendv = connection_sendv;
+        ICECAST_LOG_DEBUG("kernel TLS sending on connection %lu", con->id);
+    }
+#endif
+}
+
 int poll(struct pollfd *arr : itype(_Array_ptr<struct pollfd>) count(len), nfds_t len, int);
 
 
-static sock_t wait_for_serversock(int timeout)
+/* wait for a connection on the primary listening sockets, extra_fd is also
+ * watched so that data from pending requests ends the wait early. A failed
+ * socket leaves a SOCK_ERROR slot behind, as slot i has to stay matched with
+ * the i-th configured listener and the sockets of the other acceptors.
+ */
+static sock_t wait_for_serversock(int extra_fd, int timeout)
 {
 #ifdef HAVE_POLL
-    _Array_ptr<struct pollfd> ufds : count(global.server_sockets) = calloc<struct pollfd>(sizeof(struct pollfd), global.server_sockets);
+    int nfds = global.server_sockets + 1;
+    _Array_ptr<struct pollfd> ufds : count(nfds) = calloc<struct pollfd>(sizeof(struct pollfd), nfds);
     int i, ret;
+    sock_t found = SOCK_ERROR;
 
+    if (ufds == NULL)
+        return SOCK_ERROR;
     for(i=0; i < global.server_sockets; i++) {
         ufds[i].fd = global.serversock[i];
         ufds[i].events = POLLIN;
         ufds[i].revents = 0;
     }
-
-    ret = poll(ufds, global.server_sockets, timeout);
-    if(ret < 0) {
-        return SOCK_ERROR;
-    }
-    else if(ret == 0) {
-        return SOCK_ERROR;
-    }
-    else {
-        int dst;
-        for(i=0; i < global.server_sockets; i++) {
-            if(ufds[i].revents & POLLIN)
-                return ufds[i].fd;
-            if(ufds[i].revents & (POLLHUP|POLLERR|POLLNVAL))
-            {
-                if (ufds[i].revents & (POLLHUP|POLLERR))
-                {
-                    sock_close (global.serversock[i]);
-                    ICECAST_LOG_WARN("Had to close a listening socket");
-                }
-                global.serversock[i] = SOCK_ERROR;
-            }
+    /* poll ignores a negative fd */
+    ufds[i].fd = extra_fd;
+    ufds[i].events = POLLIN;
+    ufds[i].revents = 0;
+
+    ret = poll(ufds, nfds, timeout);
+    for(i=0; ret > 0 && i < global.server_sockets; i++) {
+        if(ufds[i].revents & POLLIN)
+        {
+            found = ufds[i].fd;
+            break;
         }
-        /* remove any closed sockets */
-        for(i=0, dst=0; i < global.server_sockets; i++)
+        if(ufds[i].revents & (POLLHUP|POLLERR|POLLNVAL))
         {
-            if (global.serversock[i] == SOCK_ERROR)
-                continue;
-            if (i!=dst)
-                global.serversock[dst] = global.serversock[i];
-            dst++;
+            if (ufds[i].revents & (POLLHUP|POLLERR))
+            {
+                sock_close (global.serversock[i]);
+                ICECAST_LOG_WARN("Had to close a listening socket");
+            }
+            /* other acceptors may be looking up the slot */
+            global_lock();
+            global.serversock[i] = SOCK_ERROR;
+            global_unlock();
         }
-        ufds = _Dynamic_bounds_cast<_Array_ptr<struct pollfd>>(ufds, count(dst)), global.server_sockets = dst;
-        return SOCK_ERROR;
     }
+    free<struct pollfd> (ufds);
+    return found;
 #else
     fd_set rfds;
     struct timeval tv, *p=NULL;
     int i, ret;
-    sock_t max = SOCK_ERROR;
+    sock_t max = extra_fd;
 
     FD_ZERO(&rfds);
 
+    if (extra_fd >= 0)
+        FD_SET(extra_fd, &rfds);
     for(i=0; i < global.server_sockets; i++) {
+        if (global.serversock[i] == SOCK_ERROR)
+            continue;
         FD_SET(global.serversock[i], &rfds);
         if (max == SOCK_ERROR || global.serversock[i] > max)
             max = global.serversock[i];
@@ -553,22 +1036,120 @@ static sock_t wait_for_serversock(int timeout)
     }
     else {
         for(i=0; i < global.server_sockets; i++) {
-            if(FD_ISSET(global.serversock[i], &rfds))
+            if(global.serversock[i] != SOCK_ERROR && FD_ISSET(global.serversock[i], &rfds))
                 return global.serversock[i];
         }
-        return SOCK_ERROR; /* Should be impossible, stop compiler warnings */
+        return SOCK_ERROR; /* only pending requests are ready */
+    }
+#endif
+}
+
+/* wait on the sockets owned by an additional acceptor, returning the index
+ * of one ready to accept or -1. Failed sockets are closed and skipped as the
+ * index has to stay in step with global.serversock.
+ */
+static int wait_for_acceptor_sock (_Ptr<acceptor_t> acceptor, int timeout)
+{
+#ifdef HAVE_POLL
+    int count = acceptor->sock_count + 1;
+    _Array_ptr<struct pollfd> ufds : count(count) = calloc<struct pollfd>(sizeof(struct pollfd), count);
+    int i, ret, ready = -1;
+
+    if (ufds == NULL)
+        return -1;
+    for (i = 0; i < acceptor->sock_count; i++)
+    {
+        ufds[i].fd = acceptor->socks[i];
+        ufds[i].events = POLLIN;
+        ufds[i].revents = 0;
+    }
+    ufds[i].fd = acceptor->poll_fd;
+    ufds[i].events = POLLIN;
+    ufds[i].revents = 0;
+    ret = poll (ufds, count, timeout);
+    for (i = 0; ret > 0 && i < acceptor->sock_count; i++)
+    {
+        if (ufds[i].fd == SOCK_ERROR)
+            continue;
+        if (ufds[i].revents & POLLIN)
+        {
+            ready = i;
+            break;
+        }
+        if (ufds[i].revents & (POLLHUP|POLLERR|POLLNVAL))
+        {
+            if (ufds[i].revents & (POLLHUP|POLLERR))
+            {
+                sock_close (acceptor->socks[i]);
+                ICECAST_LOG_WARN("Had to close a listening socket on acceptor %d", acceptor->id);
+            }
+            acceptor->socks[i] = SOCK_ERROR;
+        }
+    }
+    free<struct pollfd> (ufds);
+    return ready;
+#else
+    fd_set rfds;
+    struct timeval tv, *p=NULL;
+    int i;
+    sock_t max = acceptor->poll_fd;
+
+    FD_ZERO(&rfds);
+    if (acceptor->poll_fd >= 0)
+        FD_SET(acceptor->poll_fd, &rfds);
+    for (i = 0; i < acceptor->sock_count; i++)
+    {
+        if (acceptor->socks[i] == SOCK_ERROR)
+            continue;
+        FD_SET(acceptor->socks[i], &rfds);
+        if (max == SOCK_ERROR || acceptor->socks[i] > max)
+            max = acceptor->socks[i];
+    }
+    if (timeout >= 0)
+    {
+        tv.tv_sec = timeout/1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        p = &tv;
     }
+    if (select (max+1, &rfds, NULL, NULL, p) <= 0)
+        return -1;
+    for (i = 0; i < acceptor->sock_count; i++)
+        if (acceptor->socks[i] != SOCK_ERROR && FD_ISSET(acceptor->socks[i], &rfds))
+            return i;
+    return -1;
 #endif
 }
 
-static _Ptr<connection_t> _accept_connection(int duration)
+static _Ptr<connection_t> _accept_connection(_Ptr<acceptor_t> acceptor, int duration)
 {
-    sock_t sock, serversock;
+    sock_t sock, serversock, primary;
     char *ip;
 
-    serversock = wait_for_serversock (duration);
-    if (serversock == SOCK_ERROR)
-        return NULL;
+    if (acceptor->id == 0)
+    {
+        serversock = primary = wait_for_serversock (acceptor->poll_fd, duration);
+        if (serversock == SOCK_ERROR)
+            return NULL;
+    }
+    else
+    {
+        int i = wait_for_acceptor_sock (acceptor, duration);
+        if (i < 0)
+            return NULL;
+        serversock = acceptor->socks[i];
+        /* the listener settings are found from the global socket, which
+         * may have failed since */
+        global_lock();
+        primary = (i < global.server_sockets) ? global.serversock[i] : SOCK_ERROR;
+        global_unlock();
+        if (primary == SOCK_ERROR)
+        {
+            ICECAST_LOG_WARN("Closing listening socket on acceptor %d, its listener has gone", acceptor->id);
+            sock_close (serversock);
+            acceptor->socks[i] = SOCK_ERROR;
+            return NULL;
+        }
+    }
 
     /* malloc enough room for a full IP address (including ipv6) */
     ip = (char *)malloc<char>(MAX_ADDR_LEN);
@@ -582,7 +1163,7 @@ static _Ptr<connection_t> _accept_connection(int duration)
             memmove (ip, ip+7, strlen (ip+7)+1);
 
         if (accept_ip_address (_Assume_bounds_cast<_Nt_array_ptr<char>>(ip, byte_count(0))))
-            con = connection_create (sock, serversock, ip);
+            con = connection_create (sock, primary, ip);
         if (con)
             return con;
         sock_close (sock);
@@ -604,46 +1185,121 @@ static _Ptr<connection_t> _accept_connection(int duration)
  * has been collected, so we now pass it onto the connection thread for
  * further processing
  */
-static void _add_connection (_Ptr<client_queue_t> node)
+static void _add_connection (_Ptr<acceptor_t> acceptor, _Ptr<client_queue_t> node)
 {
-    thread_spin_lock (&_connection_lock);
-    *_con_queue_tail = node;
-    _con_queue_tail = &node->next;
-    thread_spin_unlock (&_connection_lock);
+    *acceptor->con_queue_tail = node;
+    acceptor->con_queue_tail = &node->next;
 }
 
 
 /* this returns queued clients for the connection thread. headers are
  * already provided, but need to be parsed.
  */
-static _Ptr<client_queue_t> _get_connection(void)
+static _Ptr<client_queue_t> _get_connection(_Ptr<acceptor_t> acceptor)
 {
-    _Ptr<client_queue_t> node = NULL;
-
-    thread_spin_lock (&_connection_lock);
+    _Ptr<client_queue_t> node = acceptor->con_queue;
 
-    if (_con_queue)
+    if (node)
     {
-        node = (_Ptr<client_queue_t>)_con_queue;
-        _con_queue = node->next;
-        if (_con_queue == NULL)
-            _con_queue_tail = &_con_queue;
+        acceptor->con_queue = node->next;
+        if (acceptor->con_queue == NULL)
+            acceptor->con_queue_tail = &acceptor->con_queue;
         node->next = NULL;
     }
-
-    thread_spin_unlock (&_connection_lock);
     return node;
 }
 
 
-/* run along queue checking for any data that has come in or a timeout */
-static void process_request_queue (void)
+/* stop watching a request that is leaving the request queue */
+static void _request_unwatch (_Ptr<acceptor_t> acceptor, _Ptr<client_queue_t> node)
+{
+    if (node->watched == 0)
+    {
+        acceptor->unwatched--;
+        return;
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    {
+        struct epoll_event ev;
+
+        memset (&ev, 0, sizeof (ev));
+        epoll_ctl (acceptor->poll_fd, EPOLL_CTL_DEL, node->client->con->sock, &ev);
+    }
+#endif
+    node->watched = 0;
+}
+
+
+/* Check the bytes received since the last call for the end of the headers,
+ * returning 1 once found with stream_offset set to the first byte after
+ * them. Every terminator ends in \n so only new \n need looking behind.
+ * A shoutcast source first sends its password on a line of its own.
+ */
+static int _request_headers_complete (_Ptr<client_queue_t> node, _Array_ptr<const char> data : count(node->offset))
+{
+    int i;
+
+    for (i = node->scan_offset; i < node->offset; i++)
+    {
+        if (data[i] != '\n')
+            continue;
+        if (node->shoutcast == 1)
+        {
+            node->scan_offset = i + 1;
+            return 1;
+        }
+        /* handle \n, \r\n and nsvcap which for some strange reason has
+         * EOL as \r\r\n */
+        if ((i >= 1 && data[i-1] == '\n') ||
+                (i >= 3 && memcmp (data+i-3, "\r\n\r\n", 4) == 0) ||
+                (i >= 5 && memcmp (data+i-5, "\r\r\n\r\r\n", 6) == 0))
+        {
+            /* stream_offset refers to the start of any data sent after the
+             * http style headers, we don't want to lose those */
+            node->stream_offset = i + 1;
+            node->scan_offset = i + 1;
+            return 1;
+        }
+    }
+    node->scan_offset = i;
+    return 0;
+}
+
+
+/* run along queue checking for any data that has come in or a timeout.
+ * With epoll only requests with data waiting are read, the rest of the
+ * queue is swept for timeouts once a second.
+ */
+static void process_request_queue (_Ptr<acceptor_t> acceptor)
 {
-    _Ptr<_Ptr<client_queue_t>> node_ref = (_Ptr<_Ptr<client_queue_t>>)&_req_queue;
+    _Ptr<_Ptr<client_queue_t>> node_ref = &acceptor->req_queue;
     _Ptr<ice_config_t> config = config_get_config ();
     int timeout = config->header_timeout;
+    time_t now = time(NULL);
+    int sweep = 1, woken = 0;
     config_release_config();
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (acceptor->poll_fd >= 0)
+    {
+        struct epoll_event events[64];
+        int i, count = epoll_wait (acceptor->poll_fd, events, 64, 0);
+
+        /* level triggered, so any not collected here will be next time */
+        for (i = 0; i < count; i++)
+        {
+            client_queue_t *node = events[i].data.ptr;
+            if (node == NULL)
+                woken = 1;      /* the requeue pipe */
+            else
+                node->ready = 1;
+        }
+        sweep = (now != acceptor->last_sweep);
+        acceptor->last_sweep = now;
+    }
+#endif
+    _take_requeued (acceptor, woken);
+
     while (*node_ref)
     {
         _Ptr<client_queue_t> node = *node_ref;
@@ -652,67 +1308,41 @@ static void process_request_queue (void)
         _Nt_array_ptr<char> buf : count(len) = client->refbuf->data + node->offset;
         int newLen = 0;
 
+        if (node->ready == 0 && sweep == 0)
+        {
+            node_ref = &node->next;
+            continue;
+        }
         if (len > 0)
         {
-            if (client->con->con_time + timeout <= time(NULL))
+            if (client->con->con_time + timeout <= now)
               newLen = 0;
-            else
+            else if (node->ready)
               newLen = client_read_bytes (client, buf, len);
+            else
+            {
+                node_ref = &node->next;
+                continue;
+            }
         }
+        if (node->watched)
+            node->ready = 0;
 
         buf = _Dynamic_bounds_cast<_Nt_array_ptr<char> > (buf, count(newLen)), len = newLen;
 
         if (len > 0)
         {
-            int pass_it = 1;
-            _Array_ptr<char> ptr = ((void *)0);
-
-            /* handle \n, \r\n and nsvcap which for some strange reason has
-             * EOL as \r\r\n */
             node->offset += len;
             client->refbuf->data [node->offset] = '\000';
-            do
-            {
-                if (node->shoutcast == 1)
-                {
-                    /* password line */
-                    if (strstr (client->refbuf->data, "\r\r\n") != NULL)
-                        break;
-                    if (strstr (client->refbuf->data, "\r\n") != NULL)
-                        break;
-                    if (strstr (client->refbuf->data, "\n") != NULL)
-                        break;
-                }
-                /* stream_offset refers to the start of any data sent after the
-                 * http style headers, we don't want to lose those */
-                ptr = strstr (client->refbuf->data, "\r\r\n\r\r\n");
-                if (ptr)
-                {
-                    node->stream_offset = (ptr+6) - client->refbuf->data;
-                    break;
-                }
-                ptr = strstr (client->refbuf->data, "\r\n\r\n");
-                if (ptr)
-                {
-                    node->stream_offset = (ptr+4) - client->refbuf->data;
-                    break;
-                }
-                ptr = strstr (client->refbuf->data, "\n\n");
-                if (ptr)
-                {
-                    node->stream_offset = (ptr+2) - client->refbuf->data;
-                    break;
-                }
-                pass_it = 0;
-            } while (0);
 
-            if (pass_it)
+            if (_request_headers_complete (node, _Dynamic_bounds_cast<_Array_ptr<const char>> (client->refbuf->data, count(node->offset))))
             {
-                if ((client_queue_t **)_req_queue_tail == &(node->next))
-                    _req_queue_tail = node_ref;
+                if (acceptor->req_queue_tail == &node->next)
+                    acceptor->req_queue_tail = node_ref;
                 *node_ref = node->next;
                 node->next = NULL;
-                _add_connection (node);
+                _request_unwatch (acceptor, node);
+                _add_connection (acceptor, node);
                 continue;
             }
         }
@@ -720,9 +1350,10 @@ static void process_request_queue (void)
         {
             if (len == 0 || client->con->error)
             {
-                if ((client_queue_t **)_req_queue_tail == &node->next)
-                    _req_queue_tail = node_ref;
+                if (acceptor->req_queue_tail == &node->next)
+                    acceptor->req_queue_tail = node_ref;
                 *node_ref = node->next;
+                _request_unwatch (acceptor, node);
                 client_destroy (client);
                 free<client_queue_t> (node);
                 continue;
@@ -730,33 +1361,138 @@ static void process_request_queue (void)
         }
         node_ref = &node->next;
     }
-    _handle_connection();
+    _handle_connection(acceptor);
 }
 
 
 /* add node to the queue of requests. This is where the clients are when
  * initial http details are read.
  */
-static void _add_request_queue (_Ptr<client_queue_t> node)
+static void _add_request_queue (_Ptr<acceptor_t> acceptor, _Ptr<client_queue_t> node)
 {
-    *_req_queue_tail = node;
-    _req_queue_tail = &node->next;
+    *acceptor->req_queue_tail = node;
+    acceptor->req_queue_tail = &node->next;
+    node->watched = 0;
+#ifdef HAVE_SYS_EPOLL_H
+    /* ssl may hold decrypted data the socket does not show, so those are
+     * read on each pass */
+    if (acceptor->poll_fd >= 0
+#ifdef HAVE_OPENSSL
+            && node->client->con->ssl == NULL
+#endif
+       )
+    {
+        struct epoll_event ev;
+
+        memset (&ev, 0, sizeof (ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = (client_queue_t *)node;
+        if (epoll_ctl (acceptor->poll_fd, EPOLL_CTL_ADD, node->client->con->sock, &ev) == 0)
+            node->watched = 1;
+    }
+#endif
+    /* level triggered so anything already waiting is reported */
+    node->ready = node->watched ? 0 : 1;
+    if (node->watched == 0)
+        acceptor->unwatched++;
 }
 
 
-void connection_accept_loop (void)
+/* move any persistent connections waiting for their next request into this
+ * acceptor's queues, a pipelined request may already be complete.
+ */
+static void _take_requeued (_Ptr<acceptor_t> acceptor, int woken)
 {
-    _Ptr<connection_t> con = ((void *)0);
+    _Ptr<client_queue_t> node = NULL;
+
+    if (woken)
+    {
+        char buf[64];
+        while (read (_requeue_pipe[0], buf, sizeof (buf)) > 0)
+            ;
+    }
+    thread_spin_lock (&_requeue_lock);
+    node = _requeue_list;
+    _requeue_list = NULL;
+    thread_spin_unlock (&_requeue_lock);
+
+    while (node)
+    {
+        _Ptr<client_queue_t> next = node->next;
+
+        node->next = NULL;
+        if (node->offset && _request_headers_complete (node, _Dynamic_bounds_cast<_Array_ptr<const char>> (node->client->refbuf->data, count(node->offset))))
+            _add_connection (acceptor, node);
+        else
+            _add_request_queue (acceptor, node);
+        node = next;
+    }
+}
+
+
+/* put a client that has sent its response on a persistent connection back
+ * to wait for the next request, starting with any pipelined bytes already
+ * read.
+ */
+void connection_requeue (client_t *client : itype(_Ptr<client_t>))
+{
+    _Ptr<client_queue_t> node = calloc<client_queue_t> (1, sizeof (client_queue_t));
+    _Ptr<refbuf_t> pipelined = client->pipelined;
     _Ptr<ice_config_t> config = ((void *)0);
-    int duration = 300;
+    _Ptr<listener_t> listener = ((void *)0);
 
-    config = config_get_config ();
-    get_ssl_certificate (config);
-    config_release_config ();
+    client->pipelined = NULL;
+    if (node == NULL)
+    {
+        if (pipelined)
+            refbuf_release (pipelined);
+        client_destroy (client);
+        return;
+    }
+    client_set_queue (client, NULL);
+    client->refbuf = refbuf_new (PER_CLIENT_REFBUF_SIZE);
+    if (pipelined)
+    {
+        unsigned int len = pipelined->len;
+
+        if (len > PER_CLIENT_REFBUF_SIZE - 1)
+            len = PER_CLIENT_REFBUF_SIZE - 1;
+        memcpy (client->refbuf->data, pipelined->data, len);
+        node->offset = len;
+        refbuf_release (pipelined);
+    }
+    client->refbuf->data [node->offset] = '\000';
+    client->refbuf->data = _Assume_bounds_cast<_Nt_array_ptr<char>>(client->refbuf->data, count(0)),
+      client->refbuf->len = 0; /* force reader code to ignore buffer contents */
+    node->client = client;
+
+    global_lock();
+    config = config_get_config();
+    listener = config_get_listen_sock (config, client->con);
+    if (listener && listener->shoutcast_mount)
+        node->shoutcast_mount = strdup (listener->shoutcast_mount);
+    global_unlock();
+    config_release_config();
+
+    thread_spin_lock (&_requeue_lock);
+    node->next = _requeue_list;
+    _requeue_list = node;
+    thread_spin_unlock (&_requeue_lock);
+
+    /* a full pipe is already waking the acceptors */
+    if (_requeue_pipe[1] >= 0 && write (_requeue_pipe[1], "", 1) < 0)
+        ;
+}
+
+
+static void _acceptor_run (_Ptr<acceptor_t> acceptor)
+{
+    _Ptr<connection_t> con = ((void *)0);
+    int duration = 300;
 
     while (global.running == ICECAST_RUNNING)
     {
-        con = _accept_connection (duration);
+        con = _accept_connection (acceptor, duration);
 
         if (con)
         {
@@ -811,16 +1547,47 @@ void connection_accept_loop (void)
             global_unlock();
             config_release_config();
 
-            _add_request_queue (node);
-            stats_event_inc (NULL, "connections");
-            duration = 5;
+            _add_request_queue (acceptor, node);
+            stats_counter_add (NULL, STATS_COUNTER_CONNECTIONS, 1);
         }
+        process_request_queue (acceptor);
+
+        /* use longer timeouts when nothing waiting or pending requests
+         * wake the poll themselves */
+        if (acceptor->unwatched)
+            duration = 5;
         else
-        {
-            if (_req_queue == NULL)
-                duration = 300; /* use longer timeouts when nothing waiting */
-        }
-        process_request_queue ();
+            duration = 300;
+    }
+}
+
+
+static _Ptr<void> _acceptor_thread (_Ptr<acceptor_t> acceptor)
+{
+    _acceptor_run (acceptor);
+    return NULL;
+}
+
+
+void connection_accept_loop (void)
+{
+    _Ptr<ice_config_t> config = ((void *)0);
+    int i;
+
+    config = config_get_config ();
+    get_ssl_certificate (config);
+    config_release_config ();
+
+    for (i = 1; i < _acceptor_count; i++)
+        _acceptors[i].thread = thread_create (acceptor_t, void, "Acceptor Thread", _acceptor_thread, &_acceptors[i], THREAD_ATTACHED);
+
+    _acceptor_run (&_acceptors[0]);
+
+    for (i = 1; i < _acceptor_count; i++)
+    {
+        if (_acceptors[i].thread)
+            thread_join (_acceptors[i].thread);
+        _acceptors[i].thread = NULL;
     }
 
     /* Give all the other threads notification to shut down */
@@ -1172,7 +1939,7 @@ void source_startup (client_t *client : itype(_Ptr<client_t>), const char *uri :
 
 static void _handle_stats_request (_Ptr<client_t> client, _Nt_array_ptr<char> uri)
 {
-    stats_event_inc(NULL, "stats_connections");
+    stats_counter_add (NULL, STATS_COUNTER_STATS_CONNECTIONS, 1);
 
     if (connection_check_admin_pass (client->parser) == 0)
     {
@@ -1231,7 +1998,7 @@ static void _handle_get_request (_Ptr<client_t> client, _Nt_array_ptr<char> pass
     }
     config_release_config();
 
-    stats_event_inc(NULL, "client_connections");
+    stats_counter_add (NULL, STATS_COUNTER_CLIENT_CONNECTIONS, 1);
 
     /* Dispatch all admin requests */
     if ((strcmp(uri, "/admin.cgi") == 0) ||
@@ -1244,7 +2011,7 @@ static void _handle_get_request (_Ptr<client_t> client, _Nt_array_ptr<char> pass
     if (uri != passed_uri) free<char> (uri);
 }
 
-static void _handle_shoutcast_compatible (_Ptr<client_queue_t> node)
+static void _handle_shoutcast_compatible (_Ptr<acceptor_t> acceptor, _Ptr<client_queue_t> node)
 {
     char *http_compliant;
     int http_compliant_len = 0;
@@ -1316,8 +2083,9 @@ static void _handle_shoutcast_compatible (_Ptr<client_queue_t> node)
             node->offset -= (headers - client->refbuf->data);
             memmove (client->refbuf->data, headers, node->offset+1);
             node->shoutcast = 2;
+            node->scan_offset = 0;
             /* we've checked the password, now send it back for reading headers */
-            _add_request_queue (node);
+            _add_request_queue (acceptor, node);
             free<char> (source_password);
             return;
         }
@@ -1369,11 +2137,27 @@ static void _handle_shoutcast_compatible (_Ptr<client_queue_t> node)
 }
 
 
+/* can the connection be kept after the response. HTTP/1.1 keeps it unless
+ * told to close, HTTP/1.0 only when asked to keep it.
+ */
+static int _request_keepalive (_Ptr<http_parser_t> parser)
+{
+    _Nt_array_ptr<const char> version = (_Nt_array_ptr<const char>)httpp_getvar (parser, HTTPP_VAR_VERSION);
+    _Nt_array_ptr<const char> connection = (_Nt_array_ptr<const char>)httpp_getvar (parser, "connection");
+
+    if (strcmp ("HTTP", httpp_getvar (parser, HTTPP_VAR_PROTOCOL)) != 0 || version == NULL)
+        return 0;
+    if (strcmp (version, "1.0") == 0)
+        return connection && strcasecmp (connection, "keep-alive") == 0;
+    return connection == NULL || strcasecmp (connection, "close") != 0;
+}
+
+
 /* Connection thread. Here we take clients off the connection queue and check
  * the contents provided. We set up the parser then hand off to the specific
  * request handler.
  */
-static void _handle_connection(void)
+static void _handle_connection(_Ptr<acceptor_t> acceptor)
 {
     _Ptr<http_parser_t> parser = ((void *)0);
     _Nt_array_ptr<const char> rawuri = ((void *)0);
@@ -1381,7 +2165,7 @@ static void _handle_connection(void)
 
     while (1)
     {
-        node = _get_connection();
+        node = _get_connection(acceptor);
         if (node)
         {
             _Ptr<client_t> client = node->client;
@@ -1389,7 +2173,7 @@ static void _handle_connection(void)
             /* Check for special shoutcast compatability processing */
             if (node->shoutcast)
             {
-                _handle_shoutcast_compatible (node);
+                _handle_shoutcast_compatible (acceptor, node);
                 continue;
             }
 
@@ -1437,6 +2221,20 @@ static void _handle_connection(void)
                     continue;
                 }
 
+                connection_check_ktls (client->con);
+
+                if (parser->req_type == httpp_req_get && _request_keepalive (parser))
+                {
+                    client->keepalive = CLIENT_KEEPALIVE_ALLOWED;
+                    if (client->refbuf->len)
+                    {
+                        /* hold any pipelined request until this response is out */
+                        client->pipelined = refbuf_new (client->refbuf->len);
+                        memcpy (client->pipelined->data, client->refbuf->data, client->refbuf->len);
+                        client->refbuf->len = 0;
+                    }
+                }
+
                 if (parser->req_type == httpp_req_source || parser->req_type == httpp_req_put) {
                     _handle_source_request (client, uri);
                 }
@@ -1468,41 +2266,161 @@ static void _handle_connection(void)
 
 /* called when listening thread is not checking for incoming connections */
 
+/* number of acceptors to run, only more than one if the sockets can be
+ * shared with SO_REUSEPORT */
+static int _acceptors_wanted (_Ptr<struct ice_config_tag> config)
+{
+    int count = 1;
+#ifdef SO_REUSEPORT
+    count = config->acceptor_threads;
+    if (count < 0)
+    {
+        long cores = sysconf (_SC_NPROCESSORS_ONLN);
+        count = cores > 0 ? (int)cores : 1;
+    }
+#endif
+    return count < 1 ? 1 : count;
+}
+
+
+/* close the sockets of any additional acceptors and release the acceptors,
+ * their threads must have already finished */
+static void _acceptors_free (void)
+{
+    int i, s;
+
+    for (i = 0; i < _acceptor_count; i++)
+    {
+        _Ptr<acceptor_t> acceptor = &_acceptors[i];
+
+        if (acceptor->poll_fd >= 0)
+            close (acceptor->poll_fd);
+        for (s = 0; s < acceptor->sock_count; s++)
+            if (acceptor->socks[s] != SOCK_ERROR)
+                sock_close (acceptor->socks[s]);
+        free<sock_t> (acceptor->socks);
+    }
+    free<acceptor_t> (_acceptors);
+    _acceptors = NULL, _acceptor_count = 0;
+}
+
+
+static _Array_ptr<acceptor_t> _acceptors_create (int count, int sockets) : count(count)
+{
+    _Array_ptr<acceptor_t> acceptors : count(count) = calloc<acceptor_t> (count, sizeof (acceptor_t));
+    int i, s;
+
+    if (acceptors == NULL)
+        return NULL;
+    for (i = 0; i < count; i++)
+    {
+        _Ptr<acceptor_t> acceptor = &acceptors[i];
+
+        acceptor->id = i;
+        acceptor->req_queue_tail = &acceptor->req_queue;
+        acceptor->con_queue_tail = &acceptor->con_queue;
+#ifdef HAVE_SYS_EPOLL_H
+        acceptor->poll_fd = epoll_create (64);
+        if (acceptor->poll_fd >= 0 && _requeue_pipe[0] >= 0)
+        {
+            struct epoll_event ev;
+
+            memset (&ev, 0, sizeof (ev));
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL;
+            epoll_ctl (acceptor->poll_fd, EPOLL_CTL_ADD, _requeue_pipe[0], &ev);
+        }
+#else
+        acceptor->poll_fd = -1;
+#endif
+        if (i == 0)
+            continue;
+        acceptor->socks = calloc<sock_t> (sockets, sizeof (sock_t));
+        if (acceptor->socks == NULL)
+            continue;
+        acceptor->sock_count = sockets;
+        for (s = 0; s < sockets; s++)
+            acceptor->socks[s] = SOCK_ERROR;
+    }
+    return acceptors;
+}
+
+
+static sock_t _listener_socket (_Ptr<listener_t> listener, int shared)
+{
+    sock_t sock;
+    _Nt_array_ptr<const char> bind_address = _Assume_bounds_cast<_Nt_array_ptr<const char>>(listener->bind_address, byte_count(0));
+
+    if (shared)
+        sock = sock_get_shared_server_socket (listener->port, bind_address);
+    else
+        sock = sock_get_server_socket (listener->port, bind_address);
+    if (sock == SOCK_ERROR)
+        return SOCK_ERROR;
+    if (sock_listen (sock, ICECAST_LISTEN_QUEUE) == SOCK_ERROR)
+    {
+        sock_close (sock);
+        return SOCK_ERROR;
+    }
+    /* some win32 setups do not do TCP win scaling well, so allow an override */
+    if (listener->so_sndbuf)
+        sock_set_send_buffer (sock, listener->so_sndbuf);
+    sock_set_blocking (sock, 0);
+    return sock;
+}
+
+
 int connection_setup_sockets (_Ptr<struct ice_config_tag> config)
 {
-    int count = 0;
+    int count = 0, acceptors, i;
     _Ptr<listener_t> listener = ((void *)0);
 _Ptr<_Ptr<listener_t>> prev = ((void *)0);
 
 
+    thread_mutex_lock (&_ip_file_lock);
     free<char> (banned_ip.filename);
     banned_ip.filename = NULL;
     free<char> (allowed_ip.filename);
     allowed_ip.filename = NULL;
+    if (config)
+    {
+        /* setup the banned/allowed IP filenames from the xml */
+        if (config->banfile)
+            banned_ip.filename = ((_Nt_array_ptr<char> )strdup (config->banfile));
+
+        if (config->allowfile)
+            allowed_ip.filename = ((_Nt_array_ptr<char> )strdup (config->allowfile));
+    }
+    recheck_ip_file (&banned_ip, 1);
+    recheck_ip_file (&allowed_ip, 1);
+    thread_mutex_unlock (&_ip_file_lock);
 
     global_lock();
     if (global.serversock)
     {
         for (; count < global.server_sockets; count++)
-            sock_close (global.serversock [count]);
+            if (global.serversock [count] != SOCK_ERROR)
+                sock_close (global.serversock [count]);
         free<int> (global.serversock);
         global.serversock = NULL;
     }
+    _acceptors_free ();
     if (config == NULL)
     {
         global_unlock();
         return 0;
     }
 
-    /* setup the banned/allowed IP filenames from the xml */
-    if (config->banfile)
-        banned_ip.filename = ((_Nt_array_ptr<char> )strdup (config->banfile));
-
-    if (config->allowfile)
-        allowed_ip.filename = ((_Nt_array_ptr<char> )strdup (config->allowfile));
-
     count = 0;
     global.serversock = calloc<int> (config->listen_sock_count, sizeof (sock_t));
+    acceptors = _acceptors_wanted (config);
+    _acceptors = _acceptors_create (acceptors, config->listen_sock_count), _acceptor_count = _acceptors ? acceptors : 0;
+    if (global.serversock == NULL || _acceptors == NULL)
+    {
+        global_unlock();
+        ICECAST_LOG_ERROR("unable to allocate listener sockets");
+        return 0;
+    }
 
     listener = config->listen_sock; 
     _Checked { 
@@ -1510,27 +2428,9 @@ _Ptr<_Ptr<listener_t>> prev = ((void *)0);
     }
     while (listener)
     {
-        int successful = 0;
+        sock_t sock = _listener_socket (listener, _acceptor_count > 1);
 
-        do
-        {
-            sock_t sock = sock_get_server_socket (listener->port, _Assume_bounds_cast<_Nt_array_ptr<const char>>(listener->bind_address, byte_count(0)));
-            if (sock == SOCK_ERROR)
-                break;
-            if (sock_listen (sock, ICECAST_LISTEN_QUEUE) == SOCK_ERROR)
-            {
-                sock_close (sock);
-                break;
-            }
-            /* some win32 setups do not do TCP win scaling well, so allow an override */
-            if (listener->so_sndbuf)
-                sock_set_send_buffer (sock, listener->so_sndbuf);
-            sock_set_blocking (sock, 0);
-            successful = 1;
-            global.serversock [count] = sock;
-            count++;
-        } while(0);
-        if (successful == 0)
+        if (sock == SOCK_ERROR)
         {
             if (listener->bind_address)
                 ICECAST_LOG_ERROR("Could not create listener socket on port %d bind %s",
@@ -1542,6 +2442,18 @@ _Ptr<_Ptr<listener_t>> prev = ((void *)0);
             listener = *prev;
             continue;
         }
+        global.serversock [count] = sock;
+        for (i = 1; i < _acceptor_count; i++)
+        {
+            _Ptr<acceptor_t> acceptor = &_acceptors[i];
+
+            if (count >= acceptor->sock_count)
+                continue;
+            acceptor->socks[count] = _listener_socket (listener, 1);
+            if (acceptor->socks[count] == SOCK_ERROR)
+                ICECAST_LOG_WARN("acceptor %d could not share listener socket on port %d", i, listener->port);
+        }
+        count++;
         if (listener->bind_address)
             ICECAST_LOG_INFO("listener socket on port %d address %s", listener->port, listener->bind_address);
         else
@@ -1552,10 +2464,15 @@ _Ptr<_Ptr<listener_t>> prev = ((void *)0);
         listener = listener->next;
     }
     global.server_sockets = count;
+    for (i = 1; i < _acceptor_count; i++)
+        if (_acceptors[i].sock_count > count)
+            _acceptors[i].sock_count = count;
     global_unlock();
 
     if (count == 0)
         ICECAST_LOG_ERROR("No listening sockets established");
+    else if (_acceptor_count > 1)
+        ICECAST_LOG_INFO("accepting connections on %d threads", _acceptor_count);
 
     return count;
 }
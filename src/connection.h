@@ -55,17 +55,31 @@ typedef struct connection_tag
 
     int ((*read)(struct connection_tag *handle, void *buf : byte_count(len), size_t len)) : itype(_Ptr<int (_Ptr<struct connection_tag> handle, _Array_ptr<void> buf : byte_count(len), size_t len)>);
 
+    /* gathered write of several buffers, NULL if not possible (SSL) */
+    int ((*sendv)(struct connection_tag *handle, const struct iovec *iov, int count)) : itype(_Ptr<int (_Ptr<struct connection_tag> handle, _Array_ptr<const struct iovec> iov : count(count), int count)>);
+
     char *ip : itype(_Nt_array_ptr<char>);
     char *host : itype(_Nt_array_ptr<char>);
 
 } connection_t;
 
+typedef struct
+{
+    uint64_t hits;              /* handshakes that resumed a session */
+    uint64_t misses;            /* sessions asked for but not found */
+    uint64_t timeouts;          /* sessions found but expired */
+    uint64_t cached;            /* sessions held in the cache */
+} connection_ssl_stats_t;
+
 void connection_initialize(void);
 void connection_shutdown(void);
 void connection_accept_loop(void);
 int connection_setup_sockets (_Ptr<struct ice_config_tag> config);
+void connection_recheck_ip_files (void);
+int connection_get_ssl_stats (connection_ssl_stats_t *stats : itype(_Ptr<connection_ssl_stats_t>));
 void connection_close(connection_t *con : itype(_Ptr<connection_t>));
 connection_t *connection_create(sock_t sock, sock_t serversock, char *ip : itype(_Nt_array_ptr<char>)) : itype(_Ptr<connection_t>);
+void connection_requeue (struct _client_tag *client : itype(_Ptr<struct _client_tag>));
 int connection_complete_source (struct source_tag *source : itype(_Ptr<struct source_tag>), int response);
 
 int connection_check_pass (http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *user : itype(_Nt_array_ptr<const char>), const char *pass : itype(_Nt_array_ptr<const char>));
@@ -189,7 +189,29 @@ int format_check_file_buffer (_Ptr<struct source_tag> source, _Ptr<client_t> cli
     }
     if (client->pos == refbuf->len)
     {
-        if (get_file_data (source->intro_file, client))
+        int ret;
+        _Ptr<refbuf_t> intro = NULL;
+
+        /* the file handle is shared by all listener threads of the source */
+        thread_mutex_lock (&source->intro_lock);
+        if (client->intro_offset == 0 && source->intro_data)
+        {
+            intro = source->intro_data;
+            refbuf_addref (intro);
+        }
+        thread_mutex_unlock (&source->intro_lock);
+        if (intro)
+        {
+            /* play the loaded copy instead of reading the file */
+            client_set_queue (client, intro);
+            refbuf_release (intro);
+            client->check_buffer = format_check_intro_buffer;
+            return 0;
+        }
+        thread_mutex_lock (&source->intro_lock);
+        ret = get_file_data (source->intro_file, client);
+        thread_mutex_unlock (&source->intro_lock);
+        if (ret)
         {
             client->pos = 0;
             client->intro_offset += refbuf->len;
@@ -211,6 +233,38 @@ int format_check_file_buffer (_Ptr<struct source_tag> source, _Ptr<client_t> cli
 }
 
 
+/* clients playing an intro held in memory refer to the shared copy, once
+ * it has been sent they join the queue the same way as at the end of the
+ * intro file.
+ */
+int format_check_intro_buffer (_Ptr<struct source_tag> source, _Ptr<client_t> client)
+{
+    _Ptr<refbuf_t> refbuf = client->refbuf;
+
+    if (refbuf == NULL)
+    {
+        client->check_buffer = format_check_file_buffer;
+        return -1;
+    }
+    if (client->pos < refbuf->len)
+        return 0;
+
+    client->intro_offset = refbuf->len;
+    if (source->stream_data_tail)
+    {
+        client_set_queue (client, NULL);
+        client->check_buffer = format_check_file_buffer;
+        find_client_start (source, client);
+    }
+    else
+    {
+        client->pos = 0;  /* replay intro */
+        client->intro_offset = 0;
+    }
+    return -1;
+}
+
+
 /* call this to verify that the HTTP data has been sent and if so setup
  * callbacks to the appropriate format functions
  */
@@ -231,14 +285,18 @@ int format_check_http_buffer (source_t *source : itype(_Ptr<struct source_tag>),
             client->con->error = 1;
             return -1;
         }
+        /* the headers may not have fitted in the original buffer */
+        refbuf = client->refbuf;
         client->respcode = 200;
-        stats_event_inc (NULL, "listeners");
-        stats_event_inc (NULL, "listener_connections");
-        stats_event_inc (source->mount, "listener_connections");
+        stats_counter_add (NULL, STATS_COUNTER_LISTENERS, 1);
+        stats_counter_add (NULL, STATS_COUNTER_LISTENER_CONNECTIONS, 1);
+        stats_counter_add (&source->counters, STATS_COUNTER_LISTENER_CONNECTIONS, 1);
     }
 
     if (client->pos == refbuf->len)
     {
+        /* headers are sent, the rest of the request is done with */
+        client_shrink_request (client);
         client->write_to_client = source->format->write_buf_to_client;
         client->check_buffer = format_check_file_buffer;
         client->intro_offset = 0;
@@ -265,6 +323,67 @@ int format_generic_write_to_client (client_t *client : itype(_Ptr<client_t>))
 }
 
 
+/* Write the rest of the current buffer along with the buffers following it
+ * in the queue in one go. Only buffers sharing the same associated data
+ * (eg stream headers) are gathered so the format handlers still see each
+ * change. The client is moved along the queue by the amount written.
+ */
+int format_generic_writev_to_client (client_t *client : itype(_Ptr<client_t>))
+{
+    _Ptr<refbuf_t> refbuf = client->refbuf;
+    unsigned int pos = client->pos;
+    unsigned int total = 0;
+    unsigned int limit = format_writev_limit (client);
+    int count = 0;
+    int ret;
+
+    _Unchecked {
+    struct iovec iov[FORMAT_WRITEV_MAX_BUFFERS];
+
+    while (count < FORMAT_WRITEV_MAX_BUFFERS && total < limit)
+    {
+        unsigned int len = refbuf->len - pos;
+
+        if (len > limit - total)
+            len = limit - total;
+        if (len)
+        {
+            iov[count].iov_base = (char *)refbuf->data + pos;
+            iov[count].iov_len = len;
+            count++;
+            total += len;
+        }
+        if (refbuf->next == NULL || refbuf->next->associated != refbuf->associated)
+            break;
+        refbuf = refbuf->next;
+        pos = 0;
+    }
+    if (count == 0)
+        return 0;
+    ret = client_send_iov (client, iov, count);
+    }
+
+    if (ret > 0)
+    {
+        unsigned int bytes = ret;
+
+        while (1)
+        {
+            unsigned int remaining = client->refbuf->len - client->pos;
+
+            if (bytes <= remaining)
+            {
+                client->pos += bytes;
+                break;
+            }
+            bytes -= remaining;
+            client_set_queue (client, client->refbuf->next);
+        }
+    }
+    return ret;
+}
+
+
 /* This is the commonly used for source streams, here we just progress to
  * the next buffer in the queue if there is no more left to be written from 
  * the existing buffer.
@@ -289,43 +408,43 @@ int format_advance_queue (_Ptr<source_t> source, _Ptr<client_t> client)
 }
 
 
-static int format_prepare_headers (_Ptr<source_t> source, _Ptr<client_t> client)
+/* write out the listener response headers for the source, all but the
+ * blank line that ends them as formats may still add their own. Returns
+ * the length or -1 if they do not fit.
+ */
+static int format_build_headers (_Ptr<source_t> source, _Ptr<_Nt_array_ptr<char>> out)
 {
-    unsigned remaining;
+    unsigned size = PER_CLIENT_REFBUF_SIZE;
+    unsigned remaining = PER_CLIENT_REFBUF_SIZE;
     int bytes;
     int bitrate_filtered = 0;
-    _Ptr<avl_node> node = ((void *)0);
+    _Ptr<const http_var_t> var = NULL;
+    unsigned int pos = 0;
+    _Array_ptr<char> block : count(size) = malloc<char>(size);
 
-    remaining = client->refbuf->len;
-    _Nt_array_ptr<char> ptr : count(client->refbuf->len) = client->refbuf->data;
-    client->respcode = 200;
+    if (block == NULL)
+        return -1;
+    block[size - 1] = '\0';
+    _Nt_array_ptr<char> header : count(size - 1) = _Dynamic_bounds_cast<_Nt_array_ptr<char>>(block, count(size - 1));
+    _Nt_array_ptr<char> ptr : count(size - 1) = header;
 
-    bytes = util_http_build_header(_Dynamic_bounds_cast<_Nt_array_ptr<char>>(ptr, byte_count(0)), remaining, 0, 0, 200, NULL, source->format->contenttype, NULL, NULL, source);
+    bytes = util_http_build_header(_Dynamic_bounds_cast<_Nt_array_ptr<char>>(ptr, byte_count(0)), remaining, 0, 0, 200, NULL, source->format->contenttype, NULL, NULL, source, NULL);
     if (bytes <= 0) {
-        ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
-        client_send_500(client, "Header generation failed.");
+        free<char> (header);
         return -1;
     } else if ((bytes + 1024) >= remaining) { /* we don't know yet how much to follow but want at least 1kB free space */
-      int length = bytes + 1024;
-        _Array_ptr<char> temp : count(length) = realloc<char>(ptr, bytes + 1024);
+        int length = bytes + 1024;
+        _Array_ptr<char> temp : count(length) = realloc<char>(header, length);
+        if (temp == NULL) {
+            free<char> (header);
+            return -1;
+        }
         temp[length - 1] = '\0'; // null terminate for safety
-        _Nt_array_ptr<char> new_ptr : count(length -1) = _Dynamic_bounds_cast<_Nt_array_ptr<char>>(temp, count(length - 1));
-        if (new_ptr) {
-            ICECAST_LOG_DEBUG("Client buffer reallocation succeeded.");
-            client->refbuf->data = ptr = new_ptr;
-            client->refbuf->data = 
-              _Dynamic_bounds_cast<_Nt_array_ptr<char>>(client->refbuf->data, count(bytes + 1024)),
-                ptr = _Dynamic_bounds_cast<_Nt_array_ptr<char>>(ptr, count(bytes + 1024)),
-                client->refbuf->len = remaining = bytes + 1024;
-            bytes = util_http_build_header(_Dynamic_bounds_cast<_Nt_array_ptr<char>>(ptr, byte_count(0)), remaining, 0, 0, 200, NULL, source->format->contenttype, NULL, NULL, source);
-            if (bytes <= 0 || bytes >= remaining) {
-                ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
-                client_send_500(client, "Header generation failed.");
-                return -1;
-            }
-        } else {
-            ICECAST_LOG_ERROR("Client buffer reallocation failed. Dropping client.");
-            client_send_500(client, "Buffer reallocation failed.");
+        header = ptr = _Dynamic_bounds_cast<_Nt_array_ptr<char>>(temp, count(length - 1)),
+          size = remaining = length;
+        bytes = util_http_build_header(_Dynamic_bounds_cast<_Nt_array_ptr<char>>(ptr, byte_count(0)), remaining, 0, 0, 200, NULL, source->format->contenttype, NULL, NULL, source, NULL);
+        if (bytes <= 0 || bytes >= remaining) {
+            free<char> (header);
             return -1;
         }
     }
@@ -334,12 +453,10 @@ static int format_prepare_headers (_Ptr<source_t> source, _Ptr<client_t> client)
     ptr += bytes;
 
     /* iterate through source http headers and send to client */
-    avl_tree_rlock(source->parser->vars);
-    node = avl_get_first(source->parser->vars);
-    while (node)
+    var = httpp_next_var(source->parser, &pos);
+    while (var)
     {
         int next = 1;
-        _Ptr<http_var_t> var = avl_get<http_var_t>(node);
         bytes = 0;
         if (!strcasecmp(var->name, "ice-audio-info"))
         {
@@ -400,29 +517,87 @@ static int format_prepare_headers (_Ptr<source_t> source, _Ptr<client_t> client)
         }
 
         if (bytes < 0 || bytes >= remaining) {
-            avl_tree_unlock(source->parser->vars);
-            ICECAST_LOG_ERROR("Can not allocate headers for client %p", client);
-            client_send_500(client, "Header generation failed.");
+            free<char> (header);
             return -1;
         }
-
         remaining -= bytes;
         ptr += bytes;
         if (next)
-            node = avl_get_next(node);
+            var = httpp_next_var(source->parser, &pos);
+    }
+
+    *out = header;
+    return size - remaining;
+}
+
+
+/* drop the cached listener headers, the next listener rebuilds them */
+void format_reset_headers (source_t *source : itype(_Ptr<struct source_tag>))
+{
+    thread_mutex_lock (&source->header_lock);
+    free<char> (source->header_cache);
+    source->header_cache = NULL, source->header_cache_len = 0;
+    source->header_cache_time = 0;
+    thread_mutex_unlock (&source->header_lock);
+}
+
+
+/* the headers are the same for every listener on a source, apart from the
+ * Date line, so a copy built at most once a second is used. The format
+ * then adds any per-client fields such as icy-metaint.
+ */
+static int format_prepare_headers (_Ptr<source_t> source, _Ptr<client_t> client)
+{
+    time_t now = time (NULL);
+    unsigned int len = 0;
+    int failed = 0;
+
+    client->respcode = 200;
+
+    thread_mutex_lock (&source->header_lock);
+    if (source->header_cache == NULL || source->header_cache_time != now)
+    {
+        _Nt_array_ptr<char> header = NULL;
+        int built;
+
+        /* build without the lock as the config is needed */
+        thread_mutex_unlock (&source->header_lock);
+        built = format_build_headers (source, &header);
+        thread_mutex_lock (&source->header_lock);
+        if (built < 0)
+            failed = 1;
+        else
+        {
+            free<char> (source->header_cache);
+            source->header_cache = _Assume_bounds_cast<_Nt_array_ptr<char>>(header, count(built)),
+              source->header_cache_len = built;
+            source->header_cache_time = now;
+        }
     }
-    avl_tree_unlock(source->parser->vars);
+    if (failed == 0)
+    {
+        len = source->header_cache_len;
+        /* room for the per-client fields and the final blank line, the
+         * last byte of a refbuf is kept for the nul */
+        if (client->refbuf->total_length < len + 1024 + 1)
+        {
+            client_set_queue (client, NULL);
+            client->refbuf = refbuf_new (len + 1024);
+        }
+        memcpy (client->refbuf->data, source->header_cache, len);
+    }
+    thread_mutex_unlock (&source->header_lock);
 
-    bytes = snprintf (ptr, remaining, "\r\n");
-    if (bytes < 0 || bytes >= remaining) {
-        ICECAST_LOG_ERROR("Can not allocate headers for client %p", client);
+    if (failed)
+    {
+        ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
         client_send_500(client, "Header generation failed.");
         return -1;
     }
-    remaining -= bytes;
-    ptr += bytes;
 
-    client->refbuf->len -= remaining;
+    snprintf (client->refbuf->data + len, client->refbuf->total_length - 1 - len, "\r\n");
+    client->refbuf->data = _Dynamic_bounds_cast<_Nt_array_ptr<char>>(client->refbuf->data, count(len + 2)),
+      client->refbuf->len = len + 2;
     if (source->format->create_client_data) {
       int result;
       _Checked { 
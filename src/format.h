@@ -73,11 +73,23 @@ format_type_t format_get_type(const char *contenttype : itype(_Nt_array_ptr<cons
 char *format_get_mimetype(format_type_t type) : itype(_Ptr<char>);
 int format_get_plugin(format_type_t type, struct source_tag *source : itype(_Ptr<struct source_tag>));
 
+/* limits on a gathered write of queued buffers to one client */
+#define FORMAT_WRITEV_MAX_BUFFERS   16
+#define FORMAT_WRITEV_MAX_BYTES     32768
+
+/* the byte limit for one gathered write, the caller may have set less */
+#define format_writev_limit(client) \
+    ((client)->write_limit && (client)->write_limit < FORMAT_WRITEV_MAX_BYTES ? \
+     (client)->write_limit : FORMAT_WRITEV_MAX_BYTES)
+
 int format_generic_write_to_client (client_t *client : itype(_Ptr<client_t>));
+int format_generic_writev_to_client (client_t *client : itype(_Ptr<client_t>));
 int format_advance_queue (_Ptr<struct source_tag> source, _Ptr<client_t> client);
 int format_check_http_buffer (struct source_tag *source : itype(_Ptr<struct source_tag>), _Ptr<client_t> client);
 int format_check_file_buffer (_Ptr<struct source_tag> source, _Ptr<client_t> client);
+int format_check_intro_buffer (_Ptr<struct source_tag> source, _Ptr<client_t> client);
 
+void format_reset_headers (struct source_tag *source : itype(_Ptr<struct source_tag>));
 void format_send_general_headers(format_plugin_t *format : itype(_Ptr<format_plugin_t>), struct source_tag *source : itype(_Ptr<struct source_tag>), client_t *client : itype(_Ptr<client_t>));
 
 #endif  /* __FORMAT_H__ */
@@ -151,7 +151,7 @@ static int ebml_write_buf_to_client (_Ptr<client_t> client)
     }
     else
     _Checked {
-        client->write_to_client = format_generic_write_to_client;
+        client->write_to_client = format_generic_writev_to_client;
         return client->write_to_client(client);
     }
 
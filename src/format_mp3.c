@@ -368,7 +368,7 @@ static int send_stream_metadata (_Ptr<client_t> client, _Ptr<refbuf_t> associate
 /* Handler for writing mp3 data to a client, taking into account whether
  * client has requested shoutcast style metadata updates
  */
-static int format_mp3_write_buf_to_client(_Ptr<client_t> client)
+static int mp3_write_buf_single (_Ptr<client_t> client)
 {
     int ret, written = 0;
     mp3_client_data *client_mp3 = client->format_data;
@@ -443,6 +443,167 @@ static int format_mp3_write_buf_to_client(_Ptr<client_t> client)
     return written;
 }
 
+/* one entry of a gathered write, either mp3 data from a queue buffer or
+ * the metadata block taken from that buffer */
+struct mp3_write_part
+{
+    _Ptr<refbuf_t> refbuf;
+    _Ptr<refbuf_t> associated;
+    unsigned int len;
+    int metadata;
+};
+
+
+/* work out the metadata block to insert for the stated metadata, when last
+ * is the metadata the client already has then just a zero length block */
+static unsigned int mp3_metadata_block (_Ptr<refbuf_t> associated, _Ptr<refbuf_t> last, char **data)
+{
+    if (associated && associated != last)
+    {
+        *data = (char *)associated->data;
+        return associated->len;
+    }
+    if (associated)
+    {
+        *data = "\0";
+        return 1;
+    }
+    *data = "\001StreamTitle='';";
+    return 17;
+}
+
+
+/* Gather mp3 data from several queue buffers, plus the metadata blocks due
+ * within them, into one vectored write. The client state is then updated
+ * as if each part had been sent in turn.
+ */
+static int format_mp3_write_buf_to_client(_Ptr<client_t> client)
+{
+    mp3_client_data *client_mp3 = client->format_data;
+    struct iovec iov[FORMAT_WRITEV_MAX_BUFFERS];
+    struct mp3_write_part parts[FORMAT_WRITEV_MAX_BUFFERS];
+    _Ptr<refbuf_t> refbuf = client->refbuf;
+    _Ptr<refbuf_t> last = client_mp3->associated;
+    unsigned int pos = client->pos;
+    unsigned int since = client_mp3->since_meta_block;
+    unsigned int total = 0;
+    unsigned int limit = format_writev_limit (client);
+    int i, count = 0, ret;
+
+    /* partial metadata blocks are finished off the simple way */
+    if (client->con->sendv == NULL || client_mp3->in_metadata)
+        return mp3_write_buf_single (client);
+
+    /* leave room for a data and metadata pair on each pass */
+    while (count < FORMAT_WRITEV_MAX_BUFFERS - 1 && total < limit)
+    {
+        unsigned int len = refbuf->len - pos;
+
+        if (len == 0)
+        {
+            if (refbuf->next == NULL)
+                break;
+            refbuf = refbuf->next;
+            pos = 0;
+            continue;
+        }
+        if (client_mp3->interval && client_mp3->interval - since <= len)
+        {
+            unsigned int remaining = client_mp3->interval - since;
+            char *meta;
+            unsigned int meta_len = mp3_metadata_block (refbuf->associated, last, &meta);
+
+            /* a data and metadata pair over the limit waits for the next
+             * call, or if nothing else is gathered the data goes alone.
+             * A metadata block on its own always goes so there is progress */
+            if (total + remaining + meta_len > limit && (count || remaining))
+            {
+                if (count)
+                    break;
+                len = remaining < limit ? remaining : limit;
+                iov[count].iov_base = (char *)refbuf->data + pos;
+                iov[count].iov_len = len;
+                parts[count].refbuf = refbuf;
+                parts[count].len = len;
+                parts[count].metadata = 0;
+                count++;
+                total += len;
+                break;
+            }
+            if (remaining)
+            {
+                iov[count].iov_base = (char *)refbuf->data + pos;
+                iov[count].iov_len = remaining;
+                parts[count].refbuf = refbuf;
+                parts[count].len = remaining;
+                parts[count].metadata = 0;
+                count++;
+                pos += remaining;
+                total += remaining;
+            }
+            iov[count].iov_len = meta_len;
+            iov[count].iov_base = meta;
+            parts[count].refbuf = refbuf;
+            parts[count].associated = refbuf->associated;
+            parts[count].len = iov[count].iov_len;
+            parts[count].metadata = 1;
+            count++;
+            total += iov[count-1].iov_len;
+            last = refbuf->associated;
+            since = 0;
+            continue;
+        }
+        if (client_mp3->interval && len > client_mp3->interval - since)
+            len = client_mp3->interval - since;
+        if (len > limit - total)
+            len = limit - total;
+        iov[count].iov_base = (char *)refbuf->data + pos;
+        iov[count].iov_len = len;
+        parts[count].refbuf = refbuf;
+        parts[count].len = len;
+        parts[count].metadata = 0;
+        count++;
+        pos += len;
+        total += len;
+        since += len;
+    }
+    if (count == 0)
+        return 0;
+
+    ret = client_send_iov (client, iov, count);
+    if (ret <= 0)
+        return ret;
+
+    /* now apply what was written to the client state */
+    total = ret;
+    for (i = 0; i < count && total; i++)
+    {
+        unsigned int len = parts[i].len < total ? parts[i].len : total;
+
+        if (client->refbuf != parts[i].refbuf)
+            client_set_queue (client, parts[i].refbuf);
+        total -= len;
+        if (parts[i].metadata)
+        {
+            if (len < parts[i].len)
+            {
+                /* the remainder goes out on the next call */
+                client_mp3->metadata_offset = len;
+                client_mp3->in_metadata = 1;
+                break;
+            }
+            client_mp3->associated = parts[i].associated;
+            client_mp3->metadata_offset = 0;
+            client_mp3->since_meta_block = 0;
+            continue;
+        }
+        client->pos += len;
+        client_mp3->since_meta_block += len;
+    }
+    return ret;
+}
+
+
 static void format_mp3_free_plugin(_Ptr<format_plugin_t> self)
 {
     /* free the plugin instance */
@@ -661,8 +822,10 @@ static int format_mp3_create_client_data(_Ptr<source_t> source, _Ptr<client_t> c
     _Ptr<mp3_client_data> client_mp3 = calloc<mp3_client_data>(1,sizeof(mp3_client_data));
     _Ptr<mp3_state> source_mp3 = source->format->_state;
     _Nt_array_ptr<const char> metadata = ((void *)0);
-    /* the +-2 is for overwriting the last set of \r\n */
-    unsigned remaining = 4096 - client->refbuf->len + 2;
+    /* the +-2 is for overwriting the last set of \r\n, the buffer may be
+     * larger than PER_CLIENT_REFBUF_SIZE for long headers */
+    unsigned size = client->refbuf->total_length - 1;
+    unsigned remaining = size - client->refbuf->len + 2;
     _Nt_array_ptr<char> ptr : count(remaining) = client->refbuf->data + client->refbuf->len - 2;
     int bytes;
     _Nt_array_ptr<const char> useragent = ((void *)0);
@@ -704,8 +867,8 @@ static int format_mp3_create_client_data(_Ptr<source_t> source, _Ptr<client_t> c
 
     client->refbuf->data = _Dynamic_bounds_cast<_Nt_array_ptr<char>>( 
         client->refbuf->data, 
-        count(4096 - remaining)),
-        client->refbuf->len = 4096 - remaining;
+        count(size - remaining)),
+        client->refbuf->len = size - remaining;
 
     return 0;
 }
@@ -550,35 +550,22 @@ static int send_ogg_headers (_Ptr<client_t> client, _Ptr<refbuf_t> headers)
 static int write_buf_to_client (_Ptr<client_t> client)
 {
     _Ptr<refbuf_t> refbuf = client->refbuf;
-    unsigned len = refbuf->len - client->pos;
-    _Array_ptr<char> buf : count(len) = refbuf->data + client->pos;
     _Ptr<struct ogg_client> client_data = client_get_format<struct ogg_client>(client);
     int ret, written = 0;
 
-    do
+    if (client_data->headers != refbuf->associated)
     {
-        if (client_data->headers != refbuf->associated)
-        {
-            ret = send_ogg_headers (client, refbuf->associated);
-            if (client_data->headers_sent == 0)
-                break;
-            written += ret;
-        }
-        ret = client_send_bytes<char> (client, buf, len);
-
+        ret = send_ogg_headers (client, refbuf->associated);
         if (ret > 0)
-            client->pos += ret;
-
-        if (ret < (int)len)
-            break;
-        written += ret;
-        /* we have now written the page(s) */
-        ret = 0;
-    } while (0);
-
+            written += ret;
+        if (client_data->headers_sent == 0)
+            return written ? written : ret;
+    }
+    /* pages sharing these headers can go out together */
+    ret = format_generic_writev_to_client (client);
     if (ret > 0)
-       written += ret;
-    return written;
+        written += ret;
+    return written ? written : ret;
 }
 
 
@@ -26,6 +26,10 @@
 #include <sys/poll.h>
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 #ifndef _WIN32
 #include <unistd.h>
 #include <sys/time.h>
@@ -69,6 +73,9 @@
 
 #define BUFSIZE 4096
 
+/* largest amount handed to a single sendfile call */
+#define SENDFILE_CHUNK 65536
+
 static volatile int __inited = 0;
 
 static _Ptr<fserve_t> active_list = NULL;
@@ -273,6 +280,30 @@ static int wait_for_fds(void)
     return -1;
 }
 
+#ifdef HAVE_SYS_SENDFILE_H
+/* send the next part of the file directly from the file descriptor,
+ * returns 0 once the end of file is reached
+ */
+static int fserve_sendfile (_Ptr<fserve_t> fclient)
+{
+    _Ptr<client_t> client = fclient->client;
+    ssize_t ret;
+
+    _Unchecked {
+        ret = sendfile (client->con->sock, fileno ((FILE *)fclient->file),
+                &fclient->offset, SENDFILE_CHUNK);
+    }
+    if (ret < 0)
+    {
+        if (! sock_recoverable (sock_error()))
+            client->con->error = 1;
+        return 1;
+    }
+    client->con->sent_bytes += ret;
+    return ret > 0;
+}
+#endif
+
 static _Ptr<void> fserv_thread_function(_Ptr<fserve_t> fclient)
 {
     _Ptr<_Ptr<fserve_t>> trail = ((void *)0);
@@ -295,37 +326,56 @@ static _Ptr<void> fserv_thread_function(_Ptr<fserve_t> fclient)
                 _Ptr<client_t> client = fclient->client;
                 _Ptr<refbuf_t> refbuf = client->refbuf;
                 fclient->ready = 0;
-                if (client->pos == refbuf->len)
+#ifdef HAVE_SYS_SENDFILE_H
+                if (fclient->use_sendfile && client->pos == refbuf->len)
                 {
-                    /* Grab a new chunk */
-                    if (fclient->file)
-                        bytes = fread (refbuf->data, 1, BUFSIZE, fclient->file);
-                    else
-                        bytes = 0;
-                    if (bytes == 0)
+                    /* headers are out, the file goes straight to the socket */
+                    if (fserve_sendfile (fclient) == 0)
                     {
-                        if (refbuf->next == NULL)
+                        _Ptr<fserve_t> to_go = fclient;
+                        fclient = fclient->next;
+                        *trail = fclient;
+                        fserve_client_destroy (to_go);
+                        fserve_clients--;
+                        client_tree_changed = 1;
+                        continue;
+                    }
+                }
+                else
+#endif
+                {
+                    if (client->pos == refbuf->len)
+                    {
+                        /* Grab a new chunk */
+                        if (fclient->file)
+                            bytes = fread (refbuf->data, 1, BUFSIZE, fclient->file);
+                        else
+                            bytes = 0;
+                        if (bytes == 0)
                         {
-                            _Ptr<fserve_t> to_go = fclient;
-                            fclient = fclient->next;
-                            *trail = fclient;
-                            fserve_client_destroy (to_go);
-                            fserve_clients--;
-                            client_tree_changed = 1;
-                            continue;
+                            if (refbuf->next == NULL)
+                            {
+                                _Ptr<fserve_t> to_go = fclient;
+                                fclient = fclient->next;
+                                *trail = fclient;
+                                fserve_client_destroy (to_go);
+                                fserve_clients--;
+                                client_tree_changed = 1;
+                                continue;
+                            }
+                            refbuf = refbuf->next;
+                            client->refbuf->next = NULL;
+                            refbuf_release (client->refbuf);
+                            client->refbuf = refbuf;
+                            bytes = refbuf->len;
                         }
-                        refbuf = refbuf->next;
-                        client->refbuf->next = NULL;
-                        refbuf_release (client->refbuf);
-                        client->refbuf = refbuf;
-                        bytes = refbuf->len;
+                        refbuf->data = _Assume_bounds_cast<_Nt_array_ptr<char>>(refbuf->data, count(bytes)), refbuf->len = (unsigned int)bytes;
+                        client->pos = 0;
                     }
-                    refbuf->data = _Assume_bounds_cast<_Nt_array_ptr<char>>(refbuf->data, count(bytes)), refbuf->len = (unsigned int)bytes;
-                    client->pos = 0;
-                }
 
-                /* Now try and send current chunk. */
-                format_generic_write_to_client (client);
+                    /* Now try and send current chunk. */
+                    format_generic_write_to_client (client);
+                }
 
                 if (client->con->error)
                 {
@@ -398,7 +448,7 @@ static void fserve_client_destroy(_Ptr<fserve_t> fclient)
             fclient->callback (fclient->client, fclient->arg);
         else
             if (fclient->client)
-                client_destroy (fclient->client);
+                client_finish_response (fclient->client);
         free<fserve_t> (fclient);
     }
 }
@@ -460,6 +510,7 @@ int fserve_client_create (client_t *httpclient : itype(_Ptr<client_t>), const ch
         _Nt_array_ptr<const char> host = (_Nt_array_ptr<char>) httpp_getvar (httpclient->parser, "host");
         _Nt_array_ptr<char> sourceuri = ((_Nt_array_ptr<char> )strdup (path));
         _Nt_array_ptr<char> dot = (_Nt_array_ptr<char>) strrchr(sourceuri, '.');
+        char playlist _Nt_checked[512];
 
         /* at least a couple of players (fb2k/winamp) are reported to send a 
          * host header but without the port number. So if we are missing the
@@ -468,19 +519,10 @@ int fserve_client_create (client_t *httpclient : itype(_Ptr<client_t>), const ch
             host = NULL;
 
         *dot = 0;
-        httpclient->respcode = 200;
-        ret = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
-	                              0, 200, NULL,
-				      "audio/x-mpegurl", NULL, "", NULL);
-        if (ret == -1 || ret >= (BUFSIZE - 512)) { /* we want at least 512 bytes left for the content of the playlist */
-            ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
-            client_send_500(httpclient, "Header generation failed.");
-            return -1;
-        }
         if (host == NULL)
         {
 	    config = config_get_config();
-            snprintf (httpclient->refbuf->data + ret, BUFSIZE - ret,
+            snprintf (playlist, sizeof (playlist),
                     "http://%s:%d%s\r\n", 
                     config->hostname, config->port,
                     sourceuri
@@ -489,12 +531,21 @@ int fserve_client_create (client_t *httpclient : itype(_Ptr<client_t>), const ch
         }
         else
         {
-	    snprintf (httpclient->refbuf->data + ret, BUFSIZE - ret,
+	    snprintf (playlist, sizeof (playlist),
                     "http://%s%s\r\n", 
                     host, 
                     sourceuri
                     );
         }
+        httpclient->respcode = 200;
+        ret = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
+	                              0, 200, NULL,
+				      "audio/x-mpegurl", NULL, playlist, NULL, httpclient);
+        if (ret == -1 || ret >= BUFSIZE) {
+            ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+            client_send_500(httpclient, "Header generation failed.");
+            return -1;
+        }
         refbuf_widen(httpclient->refbuf);
         fserve_add_client (httpclient, NULL);
         free<char> (sourceuri);
@@ -585,7 +636,7 @@ int fserve_client_create (client_t *httpclient : itype(_Ptr<client_t>), const ch
 		bytes = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
 		                                0, 206, NULL,
 						type, NULL,
-						NULL, NULL);
+						NULL, NULL, httpclient);
                 if (bytes == -1 || bytes >= (BUFSIZE - 512)) { /* we want at least 512 bytes left */
                     ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
                     client_send_500(httpclient, "Header generation failed.");
@@ -616,7 +667,7 @@ int fserve_client_create (client_t *httpclient : itype(_Ptr<client_t>), const ch
 	bytes = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
 	                                0, 200, NULL,
 					type, NULL,
-					NULL, NULL);
+					NULL, NULL, httpclient);
         if (bytes == -1 || bytes >= (BUFSIZE - 512)) { /* we want at least 512 bytes left */
             ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
             client_send_500(httpclient, "Header generation failed.");
@@ -632,7 +683,7 @@ int fserve_client_create (client_t *httpclient : itype(_Ptr<client_t>), const ch
       httpclient->refbuf->len = bytes;
     httpclient->pos = 0;
 
-    stats_event_inc (NULL, "file_connections");
+    stats_counter_add (NULL, STATS_COUNTER_FILE_CONNECTIONS, 1);
     fserve_add_client (httpclient, _Assume_bounds_cast<_Ptr<FILE>>(file));
 
     return 0;
@@ -678,6 +729,15 @@ int fserve_add_client (client_t *client : itype(_Ptr<client_t>), FILE *file : it
     fclient->file = file;
     fclient->client = client;
     fclient->ready = 0;
+#ifdef HAVE_SYS_SENDFILE_H
+    /* plain or kernel TLS sockets only, openssl has to see the data it
+     * encrypts. Start from wherever a range request left the file */
+    if (file && client->con->sendv)
+    {
+        fclient->offset = ftello (file);
+        fclient->use_sendfile = fclient->offset >= 0;
+    }
+#endif
     fserve_add_pending (fclient);
 
     return 0;
@@ -14,6 +14,7 @@
 #define __FSERVE_H__
 
 #include <stdio.h>
+#include <sys/types.h>
 #include "cfgfile.h"
 
 typedef void (*fserve_callback_t)(client_t *, void *);
@@ -24,6 +25,8 @@ typedef struct _fserve_t
 
     FILE *file : itype(_Ptr<FILE>);
     int ready;
+    off_t offset;       /* next file position to send with sendfile */
+    int use_sendfile;
     void ((*callback)(client_t *, void *)) : itype(_Ptr<void (_Ptr<client_t>, void *)>);
     void *arg;
     _Ptr<struct _fserve_t> next;
@@ -26,20 +26,41 @@
 #define strcasecmp stricmp
 #endif
 
-#define MAX_HEADERS 32
+/* arena blocks, a request normally fits in the first one */
+#define ARENA_BLOCK_SIZE 4096
+
+/* initial variable table size, a power of two */
+#define VARTABLE_SIZE 16
+
+struct httpp_arena_tag {
+    _Ptr<struct httpp_arena_tag> next;
+    _Array_ptr<char> data : count(size);    /* follows the header */
+    size_t used;
+    size_t size;
+};
 
 /* internal functions */
 
 /* misc */
 static _Nt_array_ptr<char> _lowercase(_Nt_array_ptr<char> str);
 
-/* for avl trees */
-static int _compare_vars(void *compare_arg, void *a, void *b);
-static int _free_vars(void *key);
+/* for the arena */
+#define _arena_round(len) (((len) + 7) & ~(size_t)7)
+static int _arena_block(_Ptr<http_parser_t> parser, size_t size);
+static _Array_ptr<char> _arena_alloc(_Ptr<http_parser_t> parser, size_t len) : count(len);
+static _Nt_array_ptr<char> _arena_string(_Ptr<http_parser_t> parser, size_t len) : count(len);
+static _Nt_array_ptr<char> _arena_strdup(_Ptr<http_parser_t> parser, _Nt_array_ptr<const char> str);
+
+/* for variable tables */
+static void _table_set(_Ptr<http_parser_t> parser, _Ptr<http_vartable_t> table, _Nt_array_ptr<char> name, _Nt_array_ptr<char> value);
+static void _table_update(_Ptr<http_parser_t> parser, _Ptr<http_vartable_t> table, _Nt_array_ptr<const char> name, _Nt_array_ptr<const char> value);
+static void _table_delete(_Ptr<http_vartable_t> table, _Nt_array_ptr<const char> name);
+static void _table_free_values(_Ptr<http_vartable_t> table);
+static _Nt_array_ptr<const char> _table_get(_Ptr<http_vartable_t> table, _Nt_array_ptr<const char> name);
 
 http_parser_t *httpp_create_parser(void) : itype(_Ptr<http_parser_t>)
 {
-    return (_Ptr<http_parser_t>)malloc<http_parser_t>(sizeof(http_parser_t));
+    return (_Ptr<http_parser_t>)calloc<http_parser_t>(1, sizeof(http_parser_t));
 }
 
 void httpp_initialize(http_parser_t *parser : itype(_Ptr<http_parser_t>), http_varlist_t *defaults : itype(_Ptr<http_varlist_t>))
@@ -48,8 +69,9 @@ void httpp_initialize(http_parser_t *parser : itype(_Ptr<http_parser_t>), http_v
 
     parser->req_type = httpp_req_none;
     parser->uri = NULL;
-    parser->vars = avl_tree_new<void>((_compare_vars), NULL);
-    parser->queryvars = avl_tree_new<void>((_compare_vars), NULL);
+    memset (&parser->vars, 0, sizeof (parser->vars));
+    memset (&parser->queryvars, 0, sizeof (parser->queryvars));
+    parser->arena = NULL;
 
     /* now insert the default variables */
     list = defaults;
@@ -59,135 +81,117 @@ void httpp_initialize(http_parser_t *parser : itype(_Ptr<http_parser_t>), http_v
     }
 }
 
-static int split_headers(_Nt_array_ptr<char> data : count(len), unsigned long len, _Array_ptr<_Nt_array_ptr<char>> line : count(32))
+/* make a terminated copy of the request in the arena */
+static _Nt_array_ptr<char> copy_request(_Ptr<http_parser_t> parser, _Array_ptr<const char> http_data : count(len), unsigned long len) : count(len)
 {
-    /* first we count how many lines there are 
-    ** and set up the line[] array     
-    */
-    int lines = 0;
-    unsigned long i;
-    line[lines] = data;
-    for (i = 0; i < len && lines < MAX_HEADERS; i++) {
+    _Nt_array_ptr<char> data : count(len) = _arena_string(parser, len);
+
+    if (data == NULL)
+        return NULL;
+    memcpy<char>(data, http_data, len);
+    return data;
+}
+
+/* terminate the line starting at *pos, returning it and moving *pos past it.
+ * NULL is returned at the blank line ending the headers or the data end.
+ */
+static _Nt_array_ptr<char> next_line(_Nt_array_ptr<char> data : count(len), unsigned long len, _Ptr<unsigned long> pos)
+{
+    unsigned long i = *pos;
+    _Nt_array_ptr<char> line = NULL;
+
+    if (i >= len || data[i] == '\r' || data[i] == '\n')
+        return NULL;
+    line = &data[i];
+    for (; i < len; i++) {
         if (data[i] == '\r')
             data[i] = '\0';
-        if (data[i] == '\n') {
-            lines++;
+        else if (data[i] == '\n') {
             data[i] = '\0';
-            if (lines >= MAX_HEADERS)
-                return MAX_HEADERS;
-            if (i + 1 < len) {
-                if (data[i + 1] == '\n' || data[i + 1] == '\r')
-                    break;
-                line[lines] = &data[i + 1];
-            }
+            i++;
+            break;
         }
     }
-
-    i++;
-    while (i < len && data[i] == '\n') i++;
-
-    return lines;
+    *pos = i;
+    return line;
 }
 
-static void parse_headers(_Ptr<http_parser_t> parser, _Array_ptr<_Nt_array_ptr<char>> line : count(32), int lines)
+/* parse the name: value lines, the names are lowercased in place and both
+ * are kept as spans of the request copy */
+static void parse_headers(_Ptr<http_parser_t> parser, _Nt_array_ptr<char> data : count(len), unsigned long len, unsigned long pos)
 {
-    int l;
-    unsigned int i;
-    int whitespace;
-    _Nt_array_ptr<char> name = NULL;
-    _Nt_array_ptr<char> value = NULL;
-
-    /* parse the name: value lines. */
-    for (l = 1; l < lines; l++) {
-        whitespace = 0;
-        name = line[l];
-        value = NULL;
-        _Nt_array_ptr<char> thisline = line[l];
-        unsigned int slen = strlen(thisline) _Where thisline : bounds(thisline, thisline + slen);
-        for (i = 0; i < slen; i++) {
-            if (thisline[i] == ':') {
-                whitespace = 1;
-                thisline[i] = '\0';
-            } else {
-                if (whitespace) {
-                    whitespace = 0;
-                    while (i < slen && thisline[i] == ' ')
-                        i++;
-
-                    if (i < slen)
-                        value = &thisline[i];
-                    
-                    break;
-                }
-            }
-        }
-        
-        if (name != NULL && value != NULL) {
-            httpp_setvar(parser, _lowercase(name), value);
-            name = NULL; 
-            value = NULL;
-        }
+    _Nt_array_ptr<char> line = NULL;
+
+    while ((line = next_line(data, len, &pos)) != NULL) {
+        size_t slen = strlen(line) _Where line : bounds(line, line + slen);
+        size_t i = 0;
+
+        while (i < slen && line[i] != ':')
+            i++;
+        if (i == slen)
+            continue;
+        while (i < slen && line[i] == ':')
+            line[i++] = '\0';
+        while (i < slen && line[i] == ' ')
+            i++;
+        if (i < slen)
+            _table_set(parser, &parser->vars, _lowercase(line), &line[i]);
     }
 }
 
 int httpp_parse_response(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *http_data : itype(_Array_ptr<const char>) count(4095), unsigned long len, const char *uri : itype(_Nt_array_ptr<const char>))
 {
-    _Nt_array_ptr<char> line _Checked[MAX_HEADERS] = {((void *)0)};
-    int lines, slen,i, whitespace=0, where=0,code;
-    _Nt_array_ptr<char> version =NULL;
-_Nt_array_ptr<char> resp_code =NULL;
-_Nt_array_ptr<char> message =NULL;
+    int slen, i, whitespace=0, where=0, code;
+    unsigned long pos = 0;
+    _Nt_array_ptr<char> data : count(len) = NULL;
+    _Nt_array_ptr<char> line = NULL;
+    _Nt_array_ptr<char> version = NULL;
+    _Nt_array_ptr<char> resp_code = NULL;
+    _Nt_array_ptr<char> message = NULL;
 
-    
     if(http_data == NULL)
         return 0;
 
-    /* make a local copy of the data, including 0 terminator */
-    _Nt_array_ptr<char> data : count(len) = (_Nt_array_ptr<char>) malloc<char>(len+1);
+    data = copy_request(parser, http_data, len);
     if (data == NULL) return 0;
-    memcpy<char>(data, http_data, len);
-    data[len] = 0;
-
-    lines = split_headers(data, len, line);
 
     /* In this case, the first line contains:
      * VERSION RESPONSE_CODE MESSAGE, such as HTTP/1.0 200 OK
      */
-    slen = strlen(line[0]);
-    version = line[0];
+    line = next_line(data, len, &pos);
+    if (line == NULL)
+        return 0;
+    slen = strlen(line) _Where line : bounds(line, line + slen);
+    version = line;
     for(i=0; i < slen; i++) {
-        if(line[0][i] == ' ') {
-            line[0][i] = 0;
+        if(line[i] == ' ') {
+            line[i] = 0;
             whitespace = 1;
         } else if(whitespace) {
             whitespace = 0;
             where++;
             if(where == 1)
-                resp_code = &line[0][i];
+                resp_code = &line[i];
             else {
-                message = &line[0][i];
+                message = &line[i];
                 break;
             }
         }
     }
 
-    if(version == NULL || resp_code == NULL || message == NULL) {
-        free<char>(data);
+    if(version == NULL || resp_code == NULL || message == NULL)
         return 0;
-    }
 
-    httpp_setvar(parser, HTTPP_VAR_ERROR_CODE, resp_code);
+    _table_set(parser, &parser->vars, HTTPP_VAR_ERROR_CODE, resp_code);
     code = atoi(resp_code);
     if(code < 200 || code >= 300) {
-        httpp_setvar(parser, HTTPP_VAR_ERROR_MESSAGE, message);
+        _table_set(parser, &parser->vars, HTTPP_VAR_ERROR_MESSAGE, message);
     }
 
     httpp_setvar(parser, HTTPP_VAR_URI, uri);
-    httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "NONE");
-
-    parse_headers(parser, line, lines);
+    _table_set(parser, &parser->vars, HTTPP_VAR_REQ_TYPE, "NONE");
 
-    free<char>(data);
+    parse_headers(parser, data, len, pos);
 
     return 1;
 }
@@ -204,112 +208,104 @@ static int hex(char c)
         return -1;
 }
 
-static char *url_escape(_Nt_array_ptr<const char> src) : itype(_Nt_array_ptr<char>)
+/* decode src into the arena, NULL if badly encoded */
+static _Nt_array_ptr<char> url_escape(_Ptr<http_parser_t> parser, _Nt_array_ptr<const char> src)
 {
-    int len = strlen(src);
-    unsigned char *decoded;
-    int i;
-    char *dst;
+    size_t len = strlen(src) _Where src : bounds(src, src + len);
+    _Nt_array_ptr<char> decoded : count(len) = NULL;
+    size_t i, out = 0;
     int done = 0;
 
-    decoded = calloc<unsigned char>(1, len + 1);
-
-    dst = (char *)decoded;
+    decoded = _arena_string(parser, len);
+    if (decoded == NULL)
+        return NULL;
 
     for(i=0; i < len; i++) {
         switch(src[i]) {
         case '%':
-            if(i+2 >= len) {
-                free<unsigned char>(decoded);
+            if(i+2 >= len)
                 return NULL;
-            }
-            if(hex(src[i+1]) == -1 || hex(src[i+2]) == -1 ) {
-                free<unsigned char>(decoded);
+            if(hex(src[i+1]) == -1 || hex(src[i+2]) == -1 )
                 return NULL;
-            }
 
-            *dst++ = hex(src[i+1]) * 16  + hex(src[i+2]);
+            decoded[out++] = hex(src[i+1]) * 16  + hex(src[i+2]);
             i+= 2;
             break;
         case '+':
-            *dst++ = ' ';
+            decoded[out++] = ' ';
             break;
         case '#':
             done = 1;
             break;
         case 0:
-            free<unsigned char>(decoded);
             return NULL;
             break;
         default:
-            *dst++ = src[i];
+            decoded[out++] = src[i];
             break;
         }
         if(done)
             break;
     }
 
-    *dst = 0; /* null terminator */
+    decoded[out] = 0; /* null terminator */
 
-    return (char *)decoded;
+    return decoded;
 }
 
 /** TODO: This is almost certainly buggy in some cases */
 static void parse_query(_Ptr<http_parser_t> parser, _Nt_array_ptr<char> query)
 {
-    int len;
-    int i=0;
+    size_t len;
+    size_t i=0;
     _Nt_array_ptr<char> key = query;
-    _Nt_array_ptr<char> val =NULL;
+    _Nt_array_ptr<char> val = NULL;
 
     if(!query || !*query)
         return;
 
-    len = strlen(query);
+    len = strlen(query) _Where query : bounds(query, query + len);
 
+    /* keys are left in the request copy, values need decoding */
     while(i<len) {
         switch(query[i]) {
         case '&':
             query[i] = 0;
             if(val && key)
-                httpp_set_query_param(parser, key, val);
-            key = query+i+1;
+                _table_set(parser, &parser->queryvars, key, url_escape(parser, val));
+            key = &query[i+1];
             break;
         case '=':
             query[i] = 0;
-            val = query+i+1;
+            val = &query[i+1];
             break;
         }
         i++;
     }
 
     if(val && key) {
-        httpp_set_query_param(parser, key, val);
+        _table_set(parser, &parser->queryvars, key, url_escape(parser, val));
     }
 }
 
 int httpp_parse(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *http_data : itype(_Array_ptr<const char>), unsigned long len)
 {
-_Nt_array_ptr<char> tmp = ((void *)0);
-
-    _Nt_array_ptr<char> line _Checked[MAX_HEADERS] = {((void *)0)}; /* limited to 32 lines, should be more than enough */
+    _Nt_array_ptr<char> tmp = NULL;
     int i;
-    int lines;
+    unsigned long pos = 0;
+    _Nt_array_ptr<char> data : count(len) = NULL;
+    _Nt_array_ptr<char> line = NULL;
     _Nt_array_ptr<char> req_type = NULL;
     _Nt_array_ptr<char> uri = NULL;
     _Nt_array_ptr<char> version = NULL;
-    int whitespace, where ;
+    int whitespace, where;
+    size_t slen;
 
     if (http_data == NULL)
         return 0;
 
-    /* make a local copy of the data, including 0 terminator */
-    _Nt_array_ptr<char> data : count(len) = (_Nt_array_ptr<char>)malloc<char>(len+1);
+    data = copy_request(parser, http_data, len);
     if (data == NULL) return 0;
-    memcpy<char>(data, http_data, len);
-    data[len] = 0;
-
-    lines = split_headers(data, len, line);
 
     /* parse the first line special
     ** the format is:
@@ -317,15 +313,17 @@ _Nt_array_ptr<char> tmp = ((void *)0);
     ** eg:
     ** GET /index.html HTTP/1.0
     */
+    line = next_line(data, len, &pos);
+    if (line == NULL)
+        return 0;
     where = 0;
     whitespace = 0;
-    _Nt_array_ptr<char> thisline = line[0];
-    size_t slen = strlen(thisline) _Where thisline : bounds(thisline, thisline + slen);
-    req_type = line[0];
+    slen = strlen(line) _Where line : bounds(line, line + slen);
+    req_type = line;
     for (i = 0; i < slen; i++) {
-        if (thisline[i] == ' ') {
+        if (line[i] == ' ') {
             whitespace = 1;
-            thisline[i] = '\0';
+            line[i] = '\0';
         } else {
             /* we're just past the whitespace boundry */
             if (whitespace) {
@@ -333,10 +331,10 @@ _Nt_array_ptr<char> tmp = ((void *)0);
                 where++;
                 switch (where) {
                 case 1:
-                    uri = &thisline[i];
+                    uri = &line[i];
                     break;
                 case 2:
-                    version = &thisline[i];
+                    version = &line[i];
                     break;
                 }
             }
@@ -362,8 +360,8 @@ _Nt_array_ptr<char> tmp = ((void *)0);
     }
 
     if (uri != NULL && strlen(uri) > 0) {
-        _Nt_array_ptr<char> query = ((void *)0);
-        if((query = ((_Nt_array_ptr<char> )strchr(uri, '?'))) != NULL) {
+        _Nt_array_ptr<char> query = NULL;
+        if((query = strchr(uri, '?')) != NULL) {
             httpp_setvar(parser, HTTPP_VAR_RAWURI, uri);
             httpp_setvar(parser, HTTPP_VAR_QUERYARGS, query);
             *query = 0;
@@ -371,168 +369,164 @@ _Nt_array_ptr<char> tmp = ((void *)0);
             parse_query(parser, query);
         }
 
-        parser->uri = ((_Nt_array_ptr<char> )strdup(uri));
+        parser->uri = uri;
     } else {
-        free<char>(data);
         return 0;
     }
 
-    if ((version != NULL) && ((tmp = ((_Nt_array_ptr<char> )strchr(version, '/'))) != NULL)) {
+    if ((version != NULL) && ((tmp = strchr(version, '/')) != NULL)) {
         tmp[0] = '\0';
         if ((strlen(version) > 0) && (strlen(&tmp[1]) > 0)) {
-            httpp_setvar(parser, HTTPP_VAR_PROTOCOL, version);
-            httpp_setvar(parser, HTTPP_VAR_VERSION, &tmp[1]);
+            _table_set(parser, &parser->vars, HTTPP_VAR_PROTOCOL, version);
+            _table_set(parser, &parser->vars, HTTPP_VAR_VERSION, &tmp[1]);
         } else {
-            free<char>(data);
             return 0;
         }
     } else {
-        free<char>(data);
         return 0;
     }
 
     if (parser->req_type != httpp_req_none && parser->req_type != httpp_req_unknown) {
         switch (parser->req_type) {
         case httpp_req_get:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "GET");
+            _table_set(parser, &parser->vars, HTTPP_VAR_REQ_TYPE, "GET");
             break;
         case httpp_req_post:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "POST");
+            _table_set(parser, &parser->vars, HTTPP_VAR_REQ_TYPE, "POST");
             break;
         case httpp_req_put:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "PUT");
+            _table_set(parser, &parser->vars, HTTPP_VAR_REQ_TYPE, "PUT");
             break;
         case httpp_req_head:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "HEAD");
+            _table_set(parser, &parser->vars, HTTPP_VAR_REQ_TYPE, "HEAD");
             break;
         case httpp_req_source:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "SOURCE");
+            _table_set(parser, &parser->vars, HTTPP_VAR_REQ_TYPE, "SOURCE");
             break;
         case httpp_req_play:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "PLAY");
+            _table_set(parser, &parser->vars, HTTPP_VAR_REQ_TYPE, "PLAY");
             break;
         case httpp_req_stats:
-            httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "STATS");
+            _table_set(parser, &parser->vars, HTTPP_VAR_REQ_TYPE, "STATS");
             break;
         default:
             break;
         }
     } else {
-        free<char>(data);
         return 0;
     }
 
-    if (parser->uri != NULL) {
-        httpp_setvar(parser, HTTPP_VAR_URI, parser->uri);
-    } else {
-        free<char>(data);
-        return 0;
-    }
+    _table_set(parser, &parser->vars, HTTPP_VAR_URI, uri);
 
-    parse_headers(parser, line, lines);
-
-    free<char>(data);
+    parse_headers(parser, data, len, pos);
 
     return 1;
 }
 
 void httpp_deletevar(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>))
 {
-    http_var_t var = {};
-
     if (parser == NULL || name == NULL)
         return;
-    var.name = (_Nt_array_ptr<char>)name;
-    var.value = NULL;
-    avl_delete<void>(parser->vars, (void *)&var, (_free_vars));
+    _table_delete(&parser->vars, name);
 }
 
 void httpp_setvar(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>), const char *value : itype(_Nt_array_ptr<const char>))
 {
-    http_var_t *var;
-
     if (name == NULL || value == NULL)
         return;
 
-    var = (http_var_t *)malloc<http_var_t>(sizeof(http_var_t));
-    if (var == NULL) return;
-
-    var->name = ((_Nt_array_ptr<char> )strdup(name));
-    var->value = ((_Nt_array_ptr<char> )strdup(value));
-
-    if (httpp_getvar(parser, name) == NULL) {
-        avl_insert<void>(parser->vars, (void *)var);
-    } else {
-        avl_delete<void>(parser->vars, (void *)var, (_free_vars));
-        avl_insert<void>(parser->vars, (void *)var);
-    }
+    _table_update(parser, &parser->vars, name, value);
 }
 
 const char *httpp_getvar(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>)) : itype(_Nt_array_ptr<const char>)
 {
-    http_var_t var = {};
-    http_var_t *found;
-    void *fp;
-
     if (parser == NULL || name == NULL)
         return NULL;
 
-    fp = &found;
-    var.name = (_Nt_array_ptr<char>)name;
-    var.value = NULL;
+    return _table_get(&parser->vars, name);
+}
 
-    if (avl_get_by_key<http_var_t>(parser->vars, &var, fp) == 0)
-        return found->value;
-    else
-        return NULL;
+/* step through the variables, starting with *pos of 0, NULL at the end */
+const http_var_t *httpp_next_var(http_parser_t *parser : itype(_Ptr<http_parser_t>), unsigned int *pos : itype(_Ptr<unsigned int>)) : itype(_Ptr<const http_var_t>)
+{
+    while (*pos < parser->vars.size) {
+        _Ptr<http_var_t> var = &parser->vars.slots[(*pos)++];
+
+        if (var->value)
+            return var;
+    }
+    return NULL;
 }
 
 void httpp_set_query_param(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>), const char *value : itype(_Nt_array_ptr<const char>))
 {
-    http_var_t *var;
-
     if (name == NULL || value == NULL)
         return;
 
-    var = (http_var_t *)malloc<http_var_t>(sizeof(http_var_t));
-    if (var == NULL) return;
-
-    var->name = ((_Nt_array_ptr<char> )strdup(name));
-    var->value = ((_Nt_array_ptr<char> )url_escape(value));
-
-    if (httpp_get_query_param(parser, name) == NULL) {
-        avl_insert<void>(parser->queryvars, (void *)var);
-    } else {
-        avl_delete<void>(parser->queryvars, (void *)var, (_free_vars));
-        avl_insert<void>(parser->queryvars, (void *)var);
-    }
+    _table_set(parser, &parser->queryvars, _arena_strdup(parser, name), url_escape(parser, value));
 }
 
 const char *httpp_get_query_param(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>)) : itype(_Nt_array_ptr<const char>)
 {
-    http_var_t var = {};
-    http_var_t *found;
-    void *fp;
+    return _table_get(&parser->queryvars, name);
+}
 
-    fp = &found;
-    var.name = (_Nt_array_ptr<char>)name;
-    var.value = NULL;
+/* make a parser holding only the request type, uri and the named
+ * variables of parser, sized to fit in a single arena block. For clients
+ * that live long after the rest of the request has been used.
+ */
+http_parser_t *httpp_retain(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char **names : itype(_Array_ptr<_Nt_array_ptr<const char>>) count(count), int count) : itype(_Ptr<http_parser_t>)
+{
+    _Ptr<http_parser_t> copy = NULL;
+    size_t needed = VARTABLE_SIZE * sizeof(http_var_t);
+    int i;
 
-    if (avl_get_by_key<void>(parser->queryvars, (void *)&var, fp) == 0)
-        return found->value;
-    else
+    if (parser == NULL)
+        return NULL;
+    for (i = 0; i < count; i++) {
+        _Nt_array_ptr<const char> value = _table_get(&parser->vars, names[i]);
+
+        if (value)
+            needed += _arena_round(strlen(names[i]) + 1) + _arena_round(strlen(value) + 1);
+    }
+    if (parser->uri)
+        needed += _arena_round(strlen(parser->uri) + 1);
+
+    copy = calloc<http_parser_t>(1, sizeof(http_parser_t));
+    if (copy == NULL)
         return NULL;
+    if (_arena_block(copy, needed) < 0) {
+        free<http_parser_t>(copy);
+        return NULL;
+    }
+    copy->req_type = parser->req_type;
+    if (parser->uri)
+        copy->uri = _arena_strdup(copy, parser->uri);
+    for (i = 0; i < count; i++) {
+        _Nt_array_ptr<const char> value = _table_get(&parser->vars, names[i]);
+
+        if (value)
+            _table_set(copy, &copy->vars, _arena_strdup(copy, names[i]), _arena_strdup(copy, value));
+    }
+    return copy;
 }
 
 void httpp_clear(http_parser_t *parser : itype(_Ptr<http_parser_t>))
 {
+    _Ptr<httpp_arena_t> block = parser->arena;
+
+    _table_free_values(&parser->vars);
+    _table_free_values(&parser->queryvars);
+    while (block) {
+        _Ptr<httpp_arena_t> next = block->next;
+        free<httpp_arena_t>(block);
+        block = next;
+    }
+    parser->arena = NULL;
     parser->req_type = httpp_req_none;
-    if (parser->uri)
-        free<char>(parser->uri);
     parser->uri = NULL;
-    avl_tree_free(parser->vars, (_free_vars));
-    avl_tree_free(parser->queryvars, (_free_vars));
-    parser->vars = NULL;
+    memset (&parser->vars, 0, sizeof (parser->vars));
+    memset (&parser->queryvars, 0, sizeof (parser->queryvars));
 }
 
 void httpp_destroy(http_parser_t *parser : itype(_Ptr<http_parser_t>))
@@ -550,28 +544,197 @@ static _Nt_array_ptr<char> _lowercase(_Nt_array_ptr<char> str)
     return str;
 }
 
-static int _compare_vars(void *compare_arg, void *a, void *b)
+/* start a new arena block of size bytes */
+static int _arena_block(_Ptr<http_parser_t> parser, size_t size)
 {
-    http_var_t *vara, *varb;
+    _Ptr<httpp_arena_t> block = _Dynamic_bounds_cast<_Ptr<httpp_arena_t>>(malloc<httpp_arena_t>(sizeof(httpp_arena_t) + size));
+
+    if (block == NULL)
+        return -1;
+    /* the data is the rest of the same allocation */
+    _Unchecked {
+        block->size = size;
+        block->data = _Assume_bounds_cast<_Array_ptr<char>>((char *)((httpp_arena_t *)block + 1), count(size));
+    }
+    block->next = parser->arena;
+    block->used = 0;
+    parser->arena = block;
+    return 0;
+}
 
-    vara = (http_var_t *)a;
-    varb = (http_var_t *)b;
+/* carve len bytes from the parser arena, adding a block when needed */
+static _Array_ptr<char> _arena_alloc(_Ptr<http_parser_t> parser, size_t len) : count(len)
+{
+    _Ptr<httpp_arena_t> block = parser->arena;
+    size_t need = _arena_round(len);
 
-    return strcmp(vara->name, varb->name);
+    if (block == NULL || block->size - block->used < need) {
+        if (_arena_block(parser, need > ARENA_BLOCK_SIZE ? need : ARENA_BLOCK_SIZE) < 0)
+            return NULL;
+        block = parser->arena;
+    }
+    block->used += need;
+    return _Dynamic_bounds_cast<_Array_ptr<char>>(block->data + (block->used - need), count(len));
 }
 
-static int _free_vars(void *key)
+/* space for a string of len chars, terminated */
+static _Nt_array_ptr<char> _arena_string(_Ptr<http_parser_t> parser, size_t len) : count(len)
 {
-    http_var_t *var;
+    _Array_ptr<char> space : count(len + 1) = _arena_alloc(parser, len + 1);
+    _Nt_array_ptr<char> str : count(len) = NULL;
 
-    var = (http_var_t *)key;
+    if (space == NULL)
+        return NULL;
+    space[len] = '\0';
+    _Unchecked {
+        str = _Assume_bounds_cast<_Nt_array_ptr<char>>(space, count(len));
+    }
+    return str;
+}
 
-    if (var->name)
-        free<char>(var->name);
-    if (var->value)
-        free<char>(var->value);
-    free<http_var_t>(var);
+static _Nt_array_ptr<char> _arena_strdup(_Ptr<http_parser_t> parser, _Nt_array_ptr<const char> str)
+{
+    size_t len = strlen(str) _Where str : bounds(str, str + len);
+    _Nt_array_ptr<char> copy : count(len) = _arena_string(parser, len);
 
-    return 1;
+    if (copy)
+        memcpy<char>(copy, str, len);
+    return copy;
+}
+
+static unsigned int _hash(_Nt_array_ptr<const char> name)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+/* the slot holding name, or the free slot it would go in */
+static _Ptr<http_var_t> _table_slot(_Ptr<http_vartable_t> table, _Nt_array_ptr<const char> name)
+{
+    unsigned int mask = table->size - 1;
+    unsigned int i = _hash(name) & mask;
+
+    while (table->slots[i].name && strcmp(table->slots[i].name, name) != 0)
+        i = (i + 1) & mask;
+    return &table->slots[i];
+}
+
+/* double the table, dropping deleted entries. Old slots stay in the arena */
+static int _table_grow(_Ptr<http_parser_t> parser, _Ptr<http_vartable_t> table)
+{
+    http_vartable_t grown = { NULL, 0, 0 };
+    unsigned int size = table->size ? table->size * 2 : VARTABLE_SIZE;
+    _Array_ptr<char> space : count(size * sizeof(http_var_t)) = _arena_alloc(parser, size * sizeof(http_var_t));
+    unsigned int i;
+
+    if (space == NULL)
+        return -1;
+    memset(space, 0, size * sizeof(http_var_t));
+    _Unchecked {
+        grown.size = size;
+        grown.slots = _Assume_bounds_cast<_Array_ptr<http_var_t>>(space, count(size));
+    }
+    for (i = 0; i < table->size; i++) {
+        if (table->slots[i].value) {
+            *_table_slot(&grown, table->slots[i].name) = table->slots[i];
+            grown.used++;
+        }
+    }
+    *table = grown;
+    return 0;
 }
 
+/* name and value must stay valid for the life of the parser, a NULL value
+ * deletes */
+static void _table_set(_Ptr<http_parser_t> parser, _Ptr<http_vartable_t> table, _Nt_array_ptr<char> name, _Nt_array_ptr<char> value)
+{
+    _Ptr<http_var_t> slot = NULL;
+
+    if (name == NULL)
+        return;
+    /* keep a quarter free so probes stay short */
+    if ((table->used + 1) * 4 > table->size * 3 && _table_grow(parser, table) < 0)
+        return;
+    slot = _table_slot(table, name);
+    if (slot->name == NULL) {
+        slot->name = name;
+        table->used++;
+    }
+    if (slot->value_space) {
+        free<char>(slot->value);
+        slot->value_space = 0;
+    }
+    slot->value = value;
+}
+
+/* set a copy of value, for variables that may be set again and again. A
+ * new name and its first value go in the arena, a replacement reuses the
+ * name and goes in malloc'd space that is overwritten while it fits */
+static void _table_update(_Ptr<http_parser_t> parser, _Ptr<http_vartable_t> table, _Nt_array_ptr<const char> name, _Nt_array_ptr<const char> value)
+{
+    _Ptr<http_var_t> slot = table->size ? _table_slot(table, name) : NULL;
+    size_t len = strlen(value) _Where value : bounds(value, value + len);
+    _Array_ptr<char> space : count(len + 1) = NULL;
+
+    if (slot == NULL || slot->name == NULL) {
+        _table_set(parser, table, _arena_strdup(parser, name), _arena_strdup(parser, value));
+        return;
+    }
+    if (slot->value_space > len) {
+        /* value_space is the size of the current value's allocation */
+        _Unchecked {
+            space = _Assume_bounds_cast<_Array_ptr<char>>(slot->value, count(len + 1));
+        }
+        memmove(space, value, len);
+        space[len] = '\0';
+        return;
+    }
+    space = malloc<char>(len + 1);
+    if (space == NULL)
+        return;
+    memcpy<char>(space, value, len);
+    space[len] = '\0';
+    if (slot->value_space)
+        free<char>(slot->value);
+    _Unchecked {
+        slot->value = _Assume_bounds_cast<_Nt_array_ptr<char>>(space, count(len));
+    }
+    slot->value_space = len + 1;
+}
+
+/* drop a variable, the name keeps its slot so probes past it still work */
+static void _table_delete(_Ptr<http_vartable_t> table, _Nt_array_ptr<const char> name)
+{
+    _Ptr<http_var_t> slot = NULL;
+
+    if (table->size == 0)
+        return;
+    slot = _table_slot(table, name);
+    if (slot->name == NULL)
+        return;
+    if (slot->value_space) {
+        free<char>(slot->value);
+        slot->value_space = 0;
+    }
+    slot->value = NULL;
+}
+
+static void _table_free_values(_Ptr<http_vartable_t> table)
+{
+    unsigned int i;
+
+    for (i = 0; i < table->size; i++) {
+        if (table->slots[i].value_space)
+            free<char>(table->slots[i].value);
+    }
+}
+
+static _Nt_array_ptr<const char> _table_get(_Ptr<http_vartable_t> table, _Nt_array_ptr<const char> name)
+{
+    if (table->size == 0 || name == NULL)
+        return NULL;
+    return _table_slot(table, name)->value;
+}
@@ -29,6 +29,7 @@ typedef enum httpp_request_type_tag {
 typedef struct http_var_tag {
     char *name : itype(_Nt_array_ptr<char>);
     char *value : itype(_Nt_array_ptr<char>);
+    size_t value_space;     /* size of a value allocated outside the arena, else 0 */
 } http_var_t;
 
 typedef struct http_varlist_tag {
@@ -36,11 +37,25 @@ typedef struct http_varlist_tag {
     struct http_varlist_tag *next : itype(_Ptr<struct http_varlist_tag>);
 } http_varlist_t;
 
+/* open addressing table of variables, a NULL value marks a deleted entry */
+typedef struct http_vartable_tag {
+    _Array_ptr<http_var_t> slots : count(size);
+    unsigned int size;
+    unsigned int used;
+} http_vartable_t;
+
+typedef struct httpp_arena_tag httpp_arena_t;
+
+/* names and values point into the request copy or other memory held by the
+ * arena, all of which is released in one go by httpp_clear/httpp_destroy.
+ * A value replaced by httpp_setvar is kept outside the arena and reused by
+ * later updates */
 typedef struct http_parser_tag {
     httpp_request_type_e req_type;
     char *uri : itype(_Nt_array_ptr<char>);
-    avl_tree *vars : itype(_Ptr<avl_tree>);
-    avl_tree *queryvars : itype(_Ptr<avl_tree>);
+    http_vartable_t vars;
+    http_vartable_t queryvars;
+    _Ptr<httpp_arena_t> arena;
 } http_parser_t;
 
 #ifdef _mangle
@@ -51,9 +66,11 @@ typedef struct http_parser_tag {
 # define httpp_parse_response _mangle(httpp_parse_response)
 # define httpp_setvar _mangle(httpp_setvar)
 # define httpp_getvar _mangle(httpp_getvar)
+# define httpp_next_var _mangle(httpp_next_var)
 # define httpp_set_query_param _mangle(httpp_set_query_param)
 # define httpp_get_query_param _mangle(httpp_get_query_param)
 # define httpp_destroy _mangle(httpp_destroy)
+# define httpp_retain _mangle(httpp_retain)
 # define httpp_clear _mangle(httpp_clear)
 #endif
 
@@ -66,12 +83,14 @@ void httpp_setvar(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char
 void httpp_deletevar(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>));
 
 const char *httpp_getvar(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>)) : itype(_Nt_array_ptr<const char>);
+const http_var_t *httpp_next_var(http_parser_t *parser : itype(_Ptr<http_parser_t>), unsigned int *pos : itype(_Ptr<unsigned int>)) : itype(_Ptr<const http_var_t>);
 
 
 
 void httpp_set_query_param(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>), const char *value : itype(_Nt_array_ptr<const char>));
 const char *httpp_get_query_param(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char *name : itype(_Nt_array_ptr<const char>)) : itype(_Nt_array_ptr<const char>);
 void httpp_destroy(http_parser_t *parser : itype(_Ptr<http_parser_t>));
+http_parser_t *httpp_retain(http_parser_t *parser : itype(_Ptr<http_parser_t>), const char **names : itype(_Array_ptr<_Nt_array_ptr<const char>>) count(count), int count) : itype(_Ptr<http_parser_t>);
 void httpp_clear(http_parser_t *parser : itype(_Ptr<http_parser_t>));
  
 #endif
@@ -66,6 +66,7 @@
 #include "logging.h"
 #include "xslt.h"
 #include "fserve.h"
+#include "source.h"
 #include "yp.h"
 #include "auth.h"
 
@@ -126,12 +127,13 @@ void initialize_subsystems(void)
 
 void shutdown_subsystems(void)
 {
+    source_pool_shutdown();
     fserve_shutdown();
-    refbuf_shutdown();
     slave_shutdown();
     auth_shutdown();
     yp_shutdown();
     stats_shutdown();
+    refbuf_shutdown();
 
     global_shutdown();
     connection_shutdown();
@@ -500,6 +502,7 @@ int main(int argc, char **argv)
 
     stats_initialize(); /* We have to do this later on because of threading */
     fserve_initialize(); /* This too */
+    source_pool_initialize();
 
 #ifdef HAVE_SETUID 
     /* We'll only have getuid() if we also have setuid(), it's reasonable to
@@ -283,6 +283,23 @@ int sock_set_nodelay(sock_t sock)
             sizeof(int));
 }
 
+/* hold back partial segments while cork is set, so several small writes
+ * go out as full packets once it is cleared. Returns -1 where the
+ * platform has no way to do it.
+ */
+int sock_set_cork(sock_t sock, int cork)
+{
+#if defined(TCP_CORK)
+    return setsockopt(sock, IPPROTO_TCP, TCP_CORK, (void *)&cork,
+            sizeof(int));
+#elif defined(TCP_NOPUSH)
+    return setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, (void *)&cork,
+            sizeof(int));
+#else
+    return -1;
+#endif
+}
+
 int sock_set_keepalive(sock_t sock)
 {
     int keepalive = 1;
@@ -706,7 +723,7 @@ struct addrinfo hints;
 }
 
 
-sock_t sock_get_server_socket (int port, const char *sinterface : itype(_Nt_array_ptr<const char>))
+static sock_t _get_server_socket (int port, const char *sinterface : itype(_Nt_array_ptr<const char>), int reuseport)
 {
     struct sockaddr_storage sa;
     struct addrinfo hints, *res, *ai;
@@ -735,6 +752,10 @@ sock_t sock_get_server_socket (int port, const char *sinterface : itype(_Nt_arra
             continue;
 
         setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&on, sizeof(on));
+#ifdef SO_REUSEPORT
+        if (reuseport)
+            setsockopt (sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&on, sizeof(on));
+#endif
         on = 0;
 #ifdef IPV6_V6ONLY
         setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof on);
@@ -858,7 +879,7 @@ sock_t sock_connect_wto_bind (const char *hostname, int port, const char *bnd, i
 ** interface.  if interface is null, listen on all interfaces.
 ** returns the socket, or SOCK_ERROR on failure
 */
-sock_t sock_get_server_socket(int port, const char *sinterface)
+static sock_t _get_server_socket(int port, const char *sinterface, int reuseport)
 {
     struct sockaddr_in sa;
     int error, opt;
@@ -896,6 +917,10 @@ sock_t sock_get_server_socket(int port, const char *sinterface)
     /* reuse it if we can */
     opt = 1;
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&opt, sizeof(int));
+#ifdef SO_REUSEPORT
+    if (reuseport)
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const void *)&opt, sizeof(int));
+#endif
 
     /* bind socket to port */
     error = bind(sock, (struct sockaddr *)&sa, sizeof (struct sockaddr_in));
@@ -907,6 +932,29 @@ sock_t sock_get_server_socket(int port, const char *sinterface)
 
 #endif
 
+
+sock_t sock_get_server_socket (int port, const char *sinterface : itype(_Nt_array_ptr<const char>))
+{
+    return _get_server_socket (port, sinterface, 0);
+}
+
+
+/* sock_get_shared_server_socket
+**
+** as sock_get_server_socket, but marks the socket SO_REUSEPORT so that
+** several sockets can be bound to the same port and interface, with the
+** kernel spreading incoming connections across them.  returns SOCK_ERROR
+** where SO_REUSEPORT is not available.
+*/
+sock_t sock_get_shared_server_socket (int port, const char *sinterface : itype(_Nt_array_ptr<const char>))
+{
+#ifdef SO_REUSEPORT
+    return _get_server_socket (port, sinterface, 1);
+#else
+    return SOCK_ERROR;
+#endif
+}
+
 void sock_set_send_buffer (sock_t sock, int win_size)
 {
     setsockopt (sock, SOL_SOCKET, SO_SNDBUF, (char *) &win_size, sizeof(win_size));
@@ -80,6 +80,7 @@ struct iovec
 # define sock_set_blocking _mangle(sock_set_blocking)
 # define sock_set_nolinger _mangle(sock_set_nolinger)
 # define sock_set_nodelay _mangle(sock_set_nodelay)
+# define sock_set_cork _mangle(sock_set_cork)
 # define sock_set_keepalive _mangle(sock_set_keepalive)
 # define sock_close _mangle(sock_close)
 # define sock_connect_wto _mangle(sock_connect_wto)
@@ -94,6 +95,7 @@ struct iovec
 # define sock_read_bytes _mangle(sock_read_bytes)
 # define sock_read_line _mangle(sock_read_line)
 # define sock_get_server_socket _mangle(sock_get_server_socket)
+# define sock_get_shared_server_socket _mangle(sock_get_shared_server_socket)
 # define sock_listen _mangle(sock_listen)
 # define sock_set_send_buffer _mangle(sock_set_send_buffer)
 # define sock_accept _mangle(sock_accept)
@@ -112,6 +114,7 @@ int sock_set_blocking(sock_t sock, int block);
 int sock_set_nolinger(sock_t sock);
 int sock_set_keepalive(sock_t sock);
 int sock_set_nodelay(sock_t sock);
+int sock_set_cork(sock_t sock, int cork);
 void sock_set_send_buffer (sock_t sock, int win_size);
 void sock_set_error(int val);
 int sock_close(sock_t  sock);
@@ -127,7 +130,7 @@ int sock_write_bytes(sock_t sock, const void *buff : itype(_Array_ptr<const void
 int sock_write(sock_t sock, const char *fmt : itype(_Nt_array_ptr<const char>), ...);
 int sock_write_fmt(sock_t sock, const char *fmt : itype(_Nt_array_ptr<const char>), va_list ap);
 int sock_write_string(sock_t sock, const char *buff : itype(_Nt_array_ptr<const char>));
-ssize_t sock_writev (sock_t sock, const struct iovec *iov : itype(_Ptr<const struct iovec>), size_t count);
+ssize_t sock_writev (sock_t sock, const struct iovec *iov : itype(_Array_ptr<const struct iovec>) count(count), size_t count);
 
 
 /* Socket read functions */
@@ -136,6 +139,7 @@ int sock_read_line(sock_t sock, char *string : itype(_Array_ptr<char>) count(255
 
 /* server socket functions */
 sock_t sock_get_server_socket(int port, const char *sinterface : itype(_Nt_array_ptr<const char>));
+sock_t sock_get_shared_server_socket(int port, const char *sinterface : itype(_Nt_array_ptr<const char>));
 int sock_listen(sock_t serversock, int backlog);
 sock_t sock_accept(sock_t serversock, char *ip : itype(_Nt_array_ptr<char>), size_t len);
 
@@ -22,7 +22,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
+#include "thread/thread.h"
 #include "refbuf.h"
 
 #define CATMODULE "refbuf"
@@ -31,12 +33,280 @@
 
 #pragma CHECKED_SCOPE on
 
+/* Buffer pool
+ *
+ * refbuf headers and the data blocks for the common buffer sizes are kept
+ * on free lists instead of going back to malloc. Each thread has a small
+ * cache per size class so the usual alloc/release needs no lock, anything
+ * beyond that is moved in batches to a shared depot. Sizes larger than the
+ * biggest class are not pooled.
+ */
+#define POOL_HEADER_CLASS   0
+#define POOL_CLASSES        6
+#define POOL_CACHE_BLOCKS   32              /* per class, per thread */
+#define POOL_DEPOT_BYTES    (4*1024*1024)   /* per class, shared */
+
+static const unsigned int pool_sizes [POOL_CLASSES] =
+    { sizeof (refbuf_t), 256, 1024, PER_CLIENT_REFBUF_SIZE, 16384, 65536 };
+
+/* a free block, linked through its first word while in the depot */
+typedef struct pool_block_tag
+{
+    _Ptr<struct pool_block_tag> next;
+} pool_block_t;
+
+typedef struct refbuf_cache_tag
+{
+    _Ptr<pool_block_t> blocks [POOL_CLASSES][POOL_CACHE_BLOCKS];
+    unsigned int count [POOL_CLASSES];
+    uint64_t allocs;
+    uint64_t hits;
+    uint64_t retained;
+    _Ptr<struct refbuf_cache_tag> prev, next;
+} refbuf_cache_t;
+
+static int pool_ready;  /* once cleared, blocks come from and go to malloc/free */
+static pthread_key_t pool_key;
+static spin_t pool_lock;
+/* the following are protected by pool_lock */
+static _Ptr<pool_block_t> depot [POOL_CLASSES];
+static unsigned int depot_count [POOL_CLASSES];
+static _Ptr<refbuf_cache_t> pool_caches;
+static refbuf_pool_stats_t pool_exited;     /* counts from finished threads */
+
+
+static int pool_active (void)
+{
+    int ready;
+
+    _Unchecked {
+    ready = __atomic_load_n (&pool_ready, __ATOMIC_ACQUIRE);
+    }
+    return ready;
+}
+
+/* cache counters are only written by the owning thread but are read by
+ * anyone asking for the pool stats */
+static uint64_t pool_count_read (_Ptr<uint64_t> field)
+{
+    uint64_t value;
+
+    _Unchecked {
+    value = __atomic_load_n ((uint64_t *)field, __ATOMIC_RELAXED);
+    }
+    return value;
+}
+
+static void pool_count_add (_Ptr<uint64_t> field, uint64_t n)
+{
+    _Unchecked {
+    __atomic_store_n ((uint64_t *)field, pool_count_read (field) + n, __ATOMIC_RELAXED);
+    }
+}
+
+static void pool_count_sub (_Ptr<uint64_t> field, uint64_t n)
+{
+    _Unchecked {
+    __atomic_store_n ((uint64_t *)field, pool_count_read (field) - n, __ATOMIC_RELAXED);
+    }
+}
+
+static void pool_depot_put (int cls, _Ptr<pool_block_t> block)
+{
+    if (pool_active () == 0 ||
+            depot_count [cls] * pool_sizes [cls] >= POOL_DEPOT_BYTES)
+    {
+        free<pool_block_t> (block);
+        return;
+    }
+    block->next = depot [cls];
+    depot [cls] = block;
+    depot_count [cls]++;
+}
+
+/* hand the cache contents back to the depot and fold the counts into the
+ * totals */
+static void pool_cache_release (_Ptr<refbuf_cache_t> cache)
+{
+    int cls;
+
+    thread_spin_lock (&pool_lock);
+    for (cls = 0; cls < POOL_CLASSES; cls++)
+        while (cache->count [cls])
+            pool_depot_put (cls, cache->blocks [cls][--cache->count [cls]]);
+    pool_exited.allocs += pool_count_read (&cache->allocs);
+    pool_exited.hits += pool_count_read (&cache->hits);
+    if (cache->prev)
+        cache->prev->next = cache->next;
+    else
+        pool_caches = cache->next;
+    if (cache->next)
+        cache->next->prev = cache->prev;
+    thread_spin_unlock (&pool_lock);
+    free<refbuf_cache_t> (cache);
+}
+
+/* called by pthreads when a thread exits */
+static _Unchecked void pool_cache_exit (void *arg)
+{
+    pool_cache_release (_Assume_bounds_cast<_Ptr<refbuf_cache_t>> (arg));
+}
+
+static _Ptr<refbuf_cache_t> pool_cache (void)
+{
+    _Ptr<refbuf_cache_t> cache = NULL;
+
+    if (pool_active () == 0)
+        return NULL;
+    _Unchecked {
+    cache = _Assume_bounds_cast<_Ptr<refbuf_cache_t>> (pthread_getspecific (pool_key));
+    }
+    if (cache == NULL)
+    {
+        cache = calloc<refbuf_cache_t> (1, sizeof (refbuf_cache_t));
+        if (cache == NULL)
+            return NULL;
+        _Unchecked {
+        pthread_setspecific (pool_key, (refbuf_cache_t *)cache);
+        }
+        thread_spin_lock (&pool_lock);
+        cache->next = pool_caches;
+        if (pool_caches)
+            pool_caches->prev = cache;
+        pool_caches = cache;
+        thread_spin_unlock (&pool_lock);
+    }
+    return cache;
+}
+
+/* return a block of at least pool_sizes[cls] bytes */
+static _Ptr<pool_block_t> pool_get (int cls)
+{
+    _Ptr<refbuf_cache_t> cache = pool_cache ();
+
+    if (cache == NULL)
+        return _Dynamic_bounds_cast<_Ptr<pool_block_t>> (malloc<pool_block_t> (pool_sizes [cls]));
+
+    pool_count_add (&cache->allocs, 1);
+    if (cache->count [cls] == 0)
+    {
+        /* refill half the cache from the depot */
+        thread_spin_lock (&pool_lock);
+        while (depot [cls] && cache->count [cls] < POOL_CACHE_BLOCKS/2)
+        {
+            _Ptr<pool_block_t> block = depot [cls];
+            depot [cls] = block->next;
+            depot_count [cls]--;
+            cache->blocks [cls][cache->count [cls]++] = block;
+            pool_count_add (&cache->retained, pool_sizes [cls]);
+        }
+        thread_spin_unlock (&pool_lock);
+        if (cache->count [cls] == 0)
+            return _Dynamic_bounds_cast<_Ptr<pool_block_t>> (malloc<pool_block_t> (pool_sizes [cls]));
+    }
+    pool_count_add (&cache->hits, 1);
+    pool_count_sub (&cache->retained, pool_sizes [cls]);
+    return cache->blocks [cls][--cache->count [cls]];
+}
+
+static void pool_put (int cls, _Ptr<pool_block_t> block)
+{
+    _Ptr<refbuf_cache_t> cache = pool_cache ();
+
+    if (cache == NULL)
+    {
+        free<pool_block_t> (block);
+        return;
+    }
+    if (cache->count [cls] == POOL_CACHE_BLOCKS)
+    {
+        /* cache is full, pass half of it to the depot */
+        thread_spin_lock (&pool_lock);
+        while (cache->count [cls] > POOL_CACHE_BLOCKS/2)
+        {
+            pool_depot_put (cls, cache->blocks [cls][--cache->count [cls]]);
+            pool_count_sub (&cache->retained, pool_sizes [cls]);
+        }
+        thread_spin_unlock (&pool_lock);
+    }
+    cache->blocks [cls][cache->count [cls]++] = block;
+    pool_count_add (&cache->retained, pool_sizes [cls]);
+}
+
+/* smallest data class for size, or -1 if it is too big to pool */
+static int pool_class (unsigned int size)
+{
+    int cls;
+
+    for (cls = POOL_HEADER_CLASS+1; cls < POOL_CLASSES; cls++)
+        if (size <= pool_sizes [cls])
+            return cls;
+    return -1;
+}
+
+void refbuf_get_pool_stats (refbuf_pool_stats_t *stats : itype(_Ptr<refbuf_pool_stats_t>))
+{
+    _Ptr<refbuf_cache_t> cache = NULL;
+    int cls;
+
+    memset (stats, 0, sizeof (*stats));
+    if (pool_active () == 0)
+        return;
+    thread_spin_lock (&pool_lock);
+    *stats = pool_exited;
+    /* thread counters are read without their owner's involvement, good
+     * enough for reporting */
+    for (cache = pool_caches; cache; cache = cache->next)
+    {
+        stats->allocs += pool_count_read (&cache->allocs);
+        stats->hits += pool_count_read (&cache->hits);
+        stats->retained += pool_count_read (&cache->retained);
+    }
+    for (cls = 0; cls < POOL_CLASSES; cls++)
+        stats->retained += (uint64_t)depot_count [cls] * pool_sizes [cls];
+    thread_spin_unlock (&pool_lock);
+}
+
 void refbuf_initialize(void)
 {
+    thread_spin_create (&pool_lock);
+    _Unchecked {
+    pthread_key_create (&pool_key, pool_cache_exit);
+    __atomic_store_n (&pool_ready, 1, __ATOMIC_RELEASE);
+    }
 }
 
+/* Other threads may still be running and may hold buffers that are freed
+ * later, eg clients released by connection_shutdown. Only the calling
+ * thread's cache and the depot are emptied here, from now on every block
+ * is allocated and freed directly. The caches of other threads are freed
+ * as those threads exit, so the key and lock are left in place.
+ */
 void refbuf_shutdown(void)
 {
+    _Ptr<refbuf_cache_t> cache = NULL;
+    int cls;
+
+    _Unchecked {
+    __atomic_store_n (&pool_ready, 0, __ATOMIC_RELEASE);
+    cache = _Assume_bounds_cast<_Ptr<refbuf_cache_t>> (pthread_getspecific (pool_key));
+    if (cache)
+        pthread_setspecific (pool_key, NULL);
+    }
+    if (cache)
+        pool_cache_release (cache);
+    thread_spin_lock (&pool_lock);
+    for (cls = 0; cls < POOL_CLASSES; cls++)
+    {
+        while (depot [cls])
+        {
+            _Ptr<pool_block_t> block = depot [cls];
+            depot [cls] = block->next;
+            free<pool_block_t> (block);
+        }
+        depot_count [cls] = 0;
+    }
+    thread_spin_unlock (&pool_lock);
 }
 
 void refbuf_widen(_Ptr<refbuf_t> r) { 
@@ -48,20 +318,41 @@ refbuf_t *refbuf_new(unsigned int size) : itype(_Ptr<refbuf_t>)
 {
     _Ptr<refbuf_t> refbuf = ((void *)0);
 
-    refbuf = malloc<refbuf_t>(sizeof(refbuf_t));
+    _Unchecked {
+        refbuf = _Assume_bounds_cast<_Ptr<refbuf_t>>(pool_get (POOL_HEADER_CLASS));
+    }
     if (refbuf == NULL)
         abort();
     refbuf->data = NULL;
+    refbuf->pool_data = NULL;
+    refbuf->pool_class = -1;
     if (size)
     {
-      _Array_ptr<char> raw : count(sizeof(char) * size) = calloc<char>(sizeof(char), size); 
+      int cls = pool_class (size);
+      _Array_ptr<char> raw : count(sizeof(char) * size) = NULL;
+
+      _Unchecked {
+        if (cls < 0)
+            raw = _Assume_bounds_cast<_Array_ptr<char>>(calloc (sizeof(char), size), count(sizeof(char) * size));
+        else
+        {
+            raw = _Assume_bounds_cast<_Array_ptr<char>>(pool_get (cls), count(sizeof(char) * size));
+            if (raw)
+                memset ((char *)raw, 0, size);
+        }
+      }
+        if (raw == NULL)
+            abort();
       raw[size-1] = '\0';
       _Unchecked { 
         refbuf->len = size;
         refbuf->data = _Assume_bounds_cast<_Nt_array_ptr<char>>(raw, count(sizeof(char) * (size - 1))), refbuf->total_length = size;
       }
-        if (refbuf->data == NULL)
-            abort();
+        if (cls >= 0)
+        {
+            refbuf->pool_data = raw;
+            refbuf->pool_class = cls;
+        }
     }
     refbuf->sync_point = 0;
     refbuf->_count = 1;
@@ -71,9 +362,30 @@ refbuf_t *refbuf_new(unsigned int size) : itype(_Ptr<refbuf_t>)
     return refbuf;
 }
 
+/* Reference counts are atomic so a buffer can be held by several threads
+ * without a common lock. Taking a reference needs no ordering as the caller
+ * already holds one. Dropping one is a release so that earlier accesses to
+ * the buffer happen before it can be freed, and the final drop is an
+ * acquire so the thread doing the free sees all of those accesses.
+ */
 void refbuf_addref(refbuf_t *self : itype(_Ptr<refbuf_t>))
 {
-    self->_count++;
+    _Unchecked {
+    __atomic_fetch_add (&self->_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Snapshot of the reference count. Only meaningful when no other thread
+ * can take a new reference, eg a queued buffer checked while holding the
+ * lock that guards the queue. */
+unsigned int refbuf_count(refbuf_t *self : itype(_Ptr<refbuf_t>))
+{
+    unsigned int count;
+
+    _Unchecked {
+    count = __atomic_load_n (&self->_count, __ATOMIC_ACQUIRE);
+    }
+    return count;
 }
 
 static void refbuf_release_associated (_Ptr<refbuf_t> ref)
@@ -84,7 +396,7 @@ static void refbuf_release_associated (_Ptr<refbuf_t> ref)
     {
         _Ptr<refbuf_t> to_go = ref;
         ref = to_go->next;
-        if ( to_go->_count == 1 )
+        if (refbuf_count (to_go) == 1)
 	    to_go->next = NULL;
         refbuf_release (to_go);
     }
@@ -92,17 +404,28 @@ static void refbuf_release_associated (_Ptr<refbuf_t> ref)
 
 void refbuf_release(refbuf_t *self : itype(_Ptr<refbuf_t>))
 {
+    unsigned int count;
+
     if (self == NULL)
         return;
-    self->_count--;
-    if (self->_count == 0)
+    _Unchecked {
+    count = __atomic_sub_fetch (&self->_count, 1, __ATOMIC_ACQ_REL);
+    }
+    if (count == 0)
     {
         refbuf_release_associated (self->associated);
         if (self->next) _Unchecked {
             ICECAST_LOG_ERROR("next not null");
         }
-        free<char>(self->data);
-        free<refbuf_t>(self);
+        _Unchecked {
+            /* a pooled block goes back unless the data has been swapped
+             * out, in which case whoever did that already let go of it */
+            if (self->pool_class >= 0 && self->data == self->pool_data)
+                pool_put (self->pool_class, _Assume_bounds_cast<_Ptr<pool_block_t>> (self->data));
+            else
+                free ((char *)self->data);
+            pool_put (POOL_HEADER_CLASS, _Assume_bounds_cast<_Ptr<pool_block_t>> (self));
+        }
     }
 }
 
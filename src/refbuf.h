@@ -18,20 +18,31 @@
 #ifndef __REFBUF_H__
 #define __REFBUF_H__
 
+#include "compat.h"
+
 #define PER_CLIENT_REFBUF_SIZE  4096
 
 typedef struct _refbuf_tag
 {
     unsigned int len;
-    unsigned int _count;
+    unsigned int _count;        /* atomic, use refbuf_addref/release/count */
     unsigned int total_length;
     _Nt_array_ptr<char> data : count(total_length);
     struct _refbuf_tag *associated : itype(_Ptr<struct _refbuf_tag>);
     struct _refbuf_tag *next : itype(_Ptr<struct _refbuf_tag>);
     int sync_point;
+    _Array_ptr<char> pool_data; /* data block as handed out by the pool */
+    int pool_class;             /* size class of pool_data, -1 if not pooled */
 
 } refbuf_t;
 
+typedef struct
+{
+    uint64_t allocs;            /* blocks requested from the pool */
+    uint64_t hits;              /* requests met by a block already held */
+    uint64_t retained;          /* bytes held for reuse */
+} refbuf_pool_stats_t;
+
 void refbuf_widen(_Ptr<refbuf_t> r);
 
 void refbuf_initialize(void);
@@ -40,6 +51,8 @@ void refbuf_shutdown(void);
 refbuf_t *refbuf_new(unsigned int size) : itype(_Ptr<refbuf_t>);
 void refbuf_addref(refbuf_t *self : itype(_Ptr<refbuf_t>));
 void refbuf_release(refbuf_t *self : itype(_Ptr<refbuf_t>));
+unsigned int refbuf_count(refbuf_t *self : itype(_Ptr<refbuf_t>));
+void refbuf_get_pool_stats (refbuf_pool_stats_t *stats : itype(_Ptr<refbuf_pool_stats_t>));
 
 
 #endif  /* __REFBUF_H__ */
@@ -338,7 +338,7 @@ static void *start_relay_stream (void *arg)
             src->client = NULL;
             continue;
         }
-        stats_event_inc(NULL, "source_relay_connections");
+        stats_counter_add (NULL, STATS_COUNTER_SOURCE_RELAY_CONNECTIONS, 1);
         stats_event (relay->localmount, "source_ip", client->con->ip);
 
         source_main (relay->source);
@@ -724,6 +724,30 @@ static int update_from_master(ice_config_t *config)
 }
 
 
+/* publish the refbuf pool counters in the global stats */
+static void update_refbuf_stats (void)
+{
+    refbuf_pool_stats_t pool;
+
+    refbuf_get_pool_stats (&pool);
+    stats_event_args (NULL, "refbuf_allocs", "%" PRIu64, pool.allocs);
+    stats_event_args (NULL, "refbuf_hits", "%" PRIu64, pool.hits);
+    stats_event_args (NULL, "refbuf_bytes_retained", "%" PRIu64, pool.retained);
+}
+
+/* publish the TLS session resumption counters when SSL is in use */
+static void update_ssl_stats (void)
+{
+    connection_ssl_stats_t ssl;
+
+    if (connection_get_ssl_stats (&ssl) == 0)
+        return;
+    stats_event_args (NULL, "ssl_session_hits", "%" PRIu64, ssl.hits);
+    stats_event_args (NULL, "ssl_session_misses", "%" PRIu64, ssl.misses);
+    stats_event_args (NULL, "ssl_session_timeouts", "%" PRIu64, ssl.timeouts);
+    stats_event_args (NULL, "ssl_sessions_cached", "%" PRIu64, ssl.cached);
+}
+
 static void *_slave_thread(void *arg)
 {
     ice_config_t *config;
@@ -760,6 +784,10 @@ static void *_slave_thread(void *arg)
 
         ++interval;
 
+        update_refbuf_stats ();
+        update_ssl_stats ();
+        connection_recheck_ip_files ();
+
         /* only update relays lists when required */
         thread_mutex_lock(&_slave_mutex);
         if (max_interval <= interval)
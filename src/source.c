@@ -43,6 +43,11 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #include "thread/thread.h"
 #include "avl/avl.h"
 #include "httpp/httpp.h"
@@ -67,6 +72,9 @@
 
 #define MAX_FALLBACK_DEPTH 10
 
+/* most written to one listener on each pass over the listeners */
+#define SOURCE_LISTENER_PASS_BYTES  20000
+
 mutex_t move_clients_mutex;
 
 /* avl tree helper */
@@ -74,6 +82,13 @@ static int _compare_clients(void *compare_arg, void *a, void *b);
 static int _free_client(void *key);
 static void _parse_audio_info (_Ptr<source_t> source, _Nt_array_ptr<const char> s);
 static void source_shutdown (_Ptr<source_t> source);
+static void source_shards_start (_Ptr<source_t> source, int count);
+static void source_shards_stop (_Ptr<source_t> source);
+static void source_shards_forget (_Ptr<source_t> source);
+static void source_watch_client (_Ptr<source_t> source, _Ptr<client_t> client);
+static void source_unwatch_client (_Ptr<source_t> source, _Ptr<client_t> client);
+static void source_drop_intro (_Ptr<source_t> source);
+static void source_check_intro (_Ptr<source_t> source);
 #ifdef _WIN32
 #define source_run_script(x,y)  ICECAST_LOG_WARN("on [dis]connect scripts disabled");
 #else
@@ -111,8 +126,14 @@ _Ptr<source_t> source_reserve (const char *mount : itype(_Nt_array_ptr<const cha
 
         /* make duplicates for strings or similar */
         src->mount = strdup (mount);
+        stats_counters_register (&src->counters, src->mount);
         src->max_listeners = -1;
+        src->poll_fd = -1;
+        src->wait_fd = -1;
+        src->kick_fd = -1;
         thread_mutex_create(&src->lock);
+        thread_mutex_create(&src->intro_lock);
+        thread_mutex_create(&src->header_lock);
 
         avl_insert<source_t> (global.source_tree, src);
 
@@ -228,6 +249,7 @@ void source_clear_source (source_t *source : itype(_Ptr<source_t>))
 
     /* lets kick off any clients that are left on here */
     avl_tree_wlock (source->client_tree);
+    source_shards_forget (source);
     c=0;
     while (1)
     {
@@ -237,6 +259,7 @@ void source_clear_source (source_t *source : itype(_Ptr<source_t>))
             client_t *client = node->key;
             if (client->respcode == 200)
                 c++; /* only count clients that have had some processing */
+            source_unwatch_client (source, _Assume_bounds_cast<_Ptr<client_t>>(client));
             avl_delete<client_t> (source->client_tree, client, _free_client);
             continue;
         }
@@ -244,7 +267,7 @@ void source_clear_source (source_t *source : itype(_Ptr<source_t>))
     }
     if (c)
     {
-        stats_event_sub (NULL, "listeners", source->listeners);
+        stats_counter_add (NULL, STATS_COUNTER_LISTENERS, -(int64_t)source->listeners);
         ICECAST_LOG_INFO("%d active listeners on %s released", c, source->mount);
     }
     avl_tree_unlock (source->client_tree);
@@ -258,16 +281,26 @@ void source_clear_source (source_t *source : itype(_Ptr<source_t>))
     if (source->format && source->format->free_plugin)
         source->format->free_plugin (source->format);
     source->format = NULL;
+    format_reset_headers (source);
 
-    /* Lets clear out the source queue too */
+    /* Lets clear out the source queue too, buffers from the burst point
+     * on hold an extra reference for the burst handler. Other holders
+     * keep their own references */
+    if (source->burst_point)
+    {
+        _Ptr<refbuf_t> p = source->burst_point;
+        while (p)
+        {
+            _Ptr<refbuf_t> next = p->next;
+            refbuf_release (p);
+            p = next;
+        }
+    }
     while (source->stream_data)
     {
         _Ptr<refbuf_t> p = source->stream_data;
         source->stream_data = p->next;
         p->next = NULL;
-        /* can be referenced by burst handler as well */
-        while (p->_count > 1)
-            refbuf_release (p);
         refbuf_release (p);
     }
     source->stream_data_tail = NULL;
@@ -297,6 +330,7 @@ void source_clear_source (source_t *source : itype(_Ptr<source_t>))
         fclose (source->intro_file);
         source->intro_file = NULL;
     }
+    source_drop_intro (source);
 
     source->on_demand_req = 0;
     avl_tree_unlock (source->pending_tree);
@@ -311,9 +345,15 @@ void source_free_source (_Ptr<source_t> source)
     avl_delete<source_t> (global.source_tree, source, NULL);
     avl_tree_unlock (global.source_tree);
 
+    stats_counters_unregister (&source->counters);
+
     avl_tree_free(source->pending_tree, (_free_client));
     avl_tree_free(source->client_tree, (_free_client));
 
+    thread_mutex_destroy (&source->intro_lock);
+    format_reset_headers (source);
+    thread_mutex_destroy (&source->header_lock);
+
     /* make sure all YP entries have gone */
     yp_remove (source->mount);
 
@@ -427,6 +467,7 @@ void source_move_clients (source_t *source : itype(_Ptr<source_t>), source_t *de
 
             client = avl_get<client_t>(node);
             avl_delete<client_t> (source->client_tree, client, NULL);
+            source_unwatch_client (source, _Assume_bounds_cast<_Ptr<client_t>>(client));
 
             /* when switching a client to a different queue, be wary of the 
              * refbuf it's referring to, if it's http headers then we need
@@ -442,6 +483,7 @@ void source_move_clients (source_t *source : itype(_Ptr<source_t>), source_t *de
             avl_insert<void> (dest->pending_tree, (void *)client);
             count++;
         }
+        source_shards_forget (source);
         ICECAST_LOG_INFO("passing %lu listeners to \"%s\"", count, dest->mount);
 
         source->listeners = 0;
@@ -458,6 +500,8 @@ void source_move_clients (source_t *source : itype(_Ptr<source_t>), source_t *de
 
     avl_tree_unlock (dest->pending_tree);
     thread_mutex_unlock (&move_clients_mutex);
+    if (count)
+        source_kick (dest);
 }
 
 
@@ -468,9 +512,13 @@ void source_move_clients (source_t *source : itype(_Ptr<source_t>), source_t *de
 static _Ptr<refbuf_t> get_next_buffer(_Ptr<source_t> source)
 {
     _Ptr<refbuf_t> refbuf = NULL;
-    int delay = 250;
+    /* when data and listener readiness wake us, the timeout only paces
+     * the timeout and stats checks below */
+    int delay = source->wait_fd >= 0 ? 1000 : 250;
 
-    if (source->short_delay)
+    /* listeners cut short with data still to send need another pass, and
+     * pooled sources never block here, the pool waits for them */
+    if (source->short_delay || source->kick_fd >= 0)
         delay = 0;
     while (global.running == ICECAST_RUNNING && source->running)
     {
@@ -478,20 +526,23 @@ static _Ptr<refbuf_t> get_next_buffer(_Ptr<source_t> source)
         time_t current = time (NULL);
 
         if (source->client)
-            fds = util_timed_wait_for_fd (source->con->sock, delay);
+            fds = source_wait_for_data (source, delay);
         else
         {
             thread_sleep (delay*1000);
             source->last_read = current;
         }
 
+        stats_counter_set (&source->counters, STATS_COUNTER_BYTES_READ, (int64_t)source->format->read_bytes);
+        stats_counter_set (&source->counters, STATS_COUNTER_BYTES_SENT, (int64_t)source->format->sent_bytes);
+
         if (current >= source->client_stats_update)
         {
-            stats_event_args (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "total_bytes_read",
-                    "%"PRIu64, source->format->read_bytes);
-            stats_event_args (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "total_bytes_sent",
-                    "%"PRIu64, source->format->sent_bytes);
             source->client_stats_update = current + 5;
+            /* pick up changes to the intro file */
+            thread_mutex_lock (&source->lock);
+            source_check_intro (source);
+            thread_mutex_unlock (&source->lock);
         }
         if (fds < 0)
         {
@@ -533,16 +584,94 @@ static _Ptr<refbuf_t> get_next_buffer(_Ptr<source_t> source)
 }
 
 
+static void sendlist_link (_Ptr<_Ptr<client_t>> head, _Ptr<client_t> client)
+{
+    client->send_next = *head;
+    if (client->send_next)
+        client->send_next->send_prev = &client->send_next;
+    client->send_prev = head;
+    *head = client;
+}
+
+static void sendlist_unlink (_Ptr<client_t> client)
+{
+    if (client->send_prev == NULL)
+        return;
+    *client->send_prev = client->send_next;
+    if (client->send_next)
+        client->send_next->send_prev = client->send_prev;
+    client->send_next = NULL;
+    client->send_prev = NULL;
+}
+
+/* put a client on the ready or blocked part of list, going by its poll state */
+static void sendlist_add (_Ptr<source_sendlist_t> list, _Ptr<client_t> client)
+{
+    client->send_list = list;
+    list->count++;
+    if (client->poll_state == CLIENT_POLL_BLOCKED)
+        sendlist_link (&list->blocked, client);
+    else
+        sendlist_link (&list->ready, client);
+}
+
+static void sendlist_remove (_Ptr<client_t> client)
+{
+    sendlist_unlink (client);
+    if (client->send_list)
+        client->send_list->count--;
+    client->send_list = NULL;
+}
+
+/* move a client within its list, to the part headed by which */
+static void sendlist_move (_Ptr<client_t> client, _Ptr<_Ptr<client_t>> which)
+{
+    sendlist_unlink (client);
+    sendlist_link (which, client);
+}
+
+/* drop every client from list, they are left in the client_tree */
+static void sendlist_clear (_Ptr<source_sendlist_t> list)
+{
+    _Ptr<client_t> client = NULL;
+
+    while ((client = list->ready) || (client = list->blocked) || (client = list->failed))
+        sendlist_remove (client);
+    list->count = 0;
+}
+
+
+/* a client still on the buffer at the head of the queue when that is about
+ * to go has fallen too far behind */
+static int source_client_behind (_Ptr<source_t> source, _Ptr<client_t> client)
+{
+    if (client->refbuf == NULL || client->refbuf != source->stream_data)
+        return 0;
+    ICECAST_LOG_INFO("Client %lu (%s) has fallen too far behind, removing",
+            client->con->id, client->con->ip);
+    stats_counter_add (&source->counters, STATS_COUNTER_SLOW_LISTENERS, 1);
+    client->con->error = 1;
+    return 1;
+}
+
+
 /* general send routine per listener.  The deletion_expected tells us whether
  * the last in the queue is about to disappear, so if this client is still
  * referring to it after writing then drop the client as it's fallen too far
- * behind 
+ * behind. Returns the number of bytes written, short_delay is set if the
+ * client still has data pending.
  */ 
-static void send_to_listener (_Ptr<source_t> source, _Ptr<client_t> client, int deletion_expected)
+static int send_to_listener (_Ptr<source_t> source, _Ptr<client_t> client, int deletion_expected, _Ptr<int> short_delay)
 {
     int bytes;
     int loop = 10;   /* max number of iterations in one go */
     int total_written = 0;
+    int corked = 0;
+
+    /* a new listener gets the headers, then any intro or burst, so hold
+     * them back to go out in full segments rather than the headers alone */
+    if (client->respcode == 0 && client->con->error == 0)
+        corked = (sock_set_cork (client->con->sock, 1) == 0);
 
     while (1)
     {
@@ -558,39 +687,460 @@ static void send_to_listener (_Ptr<source_t> source, _Ptr<client_t> client, int
         if (client->con->error)
             break;
 
+        /* nothing can be written until the socket reports writable again */
+        if (client->poll_state == CLIENT_POLL_BLOCKED)
+            break;
+
         /* lets not send too much to one client in one go, but don't
            sleep for too long if more data can be sent */
-        if (total_written > 20000 || loop == 0)
+        if (total_written >= SOURCE_LISTENER_PASS_BYTES || loop == 0)
         {
-            if (client->check_buffer != format_check_file_buffer)
-                source->short_delay = 1;
+            if (client->check_buffer != format_check_file_buffer &&
+                    client->check_buffer != format_check_intro_buffer)
+                *short_delay = 1;
             break;
         }
 
         loop--;
 
         _Checked {
+        _Ptr<int (_Ptr<struct source_tag>, _Ptr<struct _client_tag>)> check = client->check_buffer;
+        _Ptr<refbuf_t> refbuf = client->refbuf;
+
         if (client->check_buffer (source, client) < 0)
+        {
+            /* moving on from the headers or intro to the next part, carry
+             * on so a corked socket gets the burst along with the headers */
+            if (client->check_buffer != check || client->refbuf != refbuf)
+                continue;
             break;
+        }
 
+        client->write_limit = SOURCE_LISTENER_PASS_BYTES - total_written;
         bytes = client->write_to_client (client);
         }
         if (bytes <= 0)
+        {
+            if (bytes < 0 && client->con->error == 0 && client->poll_state == CLIENT_POLL_READY)
+            {
+                client->poll_state = CLIENT_POLL_BLOCKED;
+                if (client->send_list)
+                    sendlist_move (client, &client->send_list->blocked);
+            }
             break;  /* can't write any more */
+        }
 
         total_written += bytes;
     }
-    source->format->sent_bytes += total_written;
+    if (corked)
+        sock_set_cork (client->con->sock, 0);
 
     /* the refbuf referenced at head (last in queue) may be marked for deletion
      * if so, check to see if this client is still referring to it */
-    if (deletion_expected && client->refbuf && client->refbuf == source->stream_data)
+    if (deletion_expected)
+        source_client_behind (source, client);
+    return total_written;
+}
+
+
+/* send to the listeners on a list that can be written to, any that fail
+ * are moved to the failed part for the source thread to release. Blocked
+ * listeners are looked at once a second for a time limit or an error set
+ * elsewhere (eg admin kill), and when the queue is about to be trimmed to
+ * drop those left holding the oldest buffer. Returns the bytes written.
+ */
+static uint64_t source_sendlist_run (_Ptr<source_t> source, _Ptr<source_sendlist_t> list,
+        int deletion_expected, _Ptr<int> short_delay)
+{
+    _Ptr<client_t> client = list->ready;
+    uint64_t sent = 0;
+    time_t now = time (NULL);
+    int sweep = (now != list->last_sweep);
+
+    while (client)
+    {
+        _Ptr<client_t> next = client->send_next;
+
+        sent += send_to_listener (source, client, deletion_expected, short_delay);
+        if (client->con->error)
+            sendlist_move (client, &list->failed);
+        client = next;
+    }
+    client = (deletion_expected || sweep) ? list->blocked : NULL;
+    while (client)
+    {
+        _Ptr<client_t> next = client->send_next;
+
+        if (sweep && client->con->discon_time && now >= client->con->discon_time)
+        {
+            ICECAST_LOG_INFO("time limit reached for client #%lu", client->con->id);
+            client->con->error = 1;
+        }
+        if (client->con->error == 0 && deletion_expected)
+            source_client_behind (source, client);
+        if (client->con->error)
+            sendlist_move (client, &list->failed);
+        client = next;
+    }
+    list->last_sweep = now;
+    return sent;
+}
+
+
+/* remove the failed listeners of a list from the source. The client_tree
+ * write lock must be held */
+static void source_sendlist_reap (_Ptr<source_t> source, _Ptr<source_sendlist_t> list)
+{
+    while (list->failed)
+    {
+        _Ptr<client_t> client = list->failed;
+
+        source_unwatch_client (source, client);
+        if (client->respcode == 200)
+            stats_counter_add (NULL, STATS_COUNTER_LISTENERS, -1);
+        avl_delete<void> (source->client_tree, (void *)client, (_free_client));
+        source->listeners--;
+        ICECAST_LOG_DEBUG("Client removed");
+    }
+}
+
+
+/* send to the listeners of one shard, any that have failed are left on the
+ * failed list for the source thread to release.
+ */
+static void source_shard_send (_Ptr<source_t> source, _Ptr<source_shard_t> shard)
+{
+    shard->sent_bytes += source_sendlist_run (source, &shard->sendlist,
+            shard->deletion_expected, &shard->short_delay);
+}
+
+
+static _Ptr<void> source_shard_thread (_Ptr<source_shard_t> shard)
+{
+    thread_mutex_lock (&shard->lock);
+    while (1)
     {
-        ICECAST_LOG_INFO("Client %lu (%s) has fallen too far behind, removing",
-                client->con->id, client->con->ip);
-        stats_event_inc (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "slow_listeners");
-        client->con->error = 1;
+        /* the condition is checked under the lock it is waited on with, so
+         * a round requested before we get here is not missed */
+        while (shard->running && shard->generation == shard->done)
+            thread_cond_wait_mutex (&shard->wakeup, &shard->lock);
+        if (shard->running == 0)
+            break;
+        thread_mutex_unlock (&shard->lock);
+
+        source_shard_send (shard->source, shard);
+
+        thread_mutex_lock (&shard->lock);
+        shard->done = shard->generation;
+        thread_cond_signal (&shard->finished);
     }
+    thread_mutex_unlock (&shard->lock);
+    return NULL;
+}
+
+
+/* run one round of sends across all the shards, the first shard is handled
+ * by the source thread itself. The client_tree write lock is held by the
+ * caller for the duration.
+ */
+static void source_shards_run (_Ptr<source_t> source, int deletion_expected)
+{
+    unsigned int i;
+
+    for (i = 1; i < source->shard_count; i++)
+    {
+        _Ptr<source_shard_t> shard = &source->shards[i];
+
+        thread_mutex_lock (&shard->lock);
+        shard->deletion_expected = deletion_expected;
+        shard->generation++;
+        thread_cond_signal (&shard->wakeup);
+        thread_mutex_unlock (&shard->lock);
+    }
+    source->shards[0].deletion_expected = deletion_expected;
+    source_shard_send (source, &source->shards[0]);
+
+    for (i = 1; i < source->shard_count; i++)
+    {
+        _Ptr<source_shard_t> shard = &source->shards[i];
+
+        thread_mutex_lock (&shard->lock);
+        while (shard->done != shard->generation)
+            thread_cond_wait_mutex (&shard->finished, &shard->lock);
+        thread_mutex_unlock (&shard->lock);
+    }
+
+    /* all workers are idle now, so collect their results */
+    for (i = 0; i < source->shard_count; i++)
+    {
+        _Ptr<source_shard_t> shard = &source->shards[i];
+
+        source_sendlist_reap (source, &shard->sendlist);
+        source->format->sent_bytes += shard->sent_bytes;
+        shard->sent_bytes = 0;
+        if (shard->short_delay)
+            source->short_delay = 1;
+        shard->short_delay = 0;
+    }
+}
+
+
+/* place a newly accepted client into the smallest shard */
+static void source_shards_add (_Ptr<source_t> source, _Ptr<client_t> client)
+{
+    _Ptr<source_shard_t> target = &source->shards[0];
+    unsigned int i;
+
+    for (i = 1; i < source->shard_count; i++)
+    {
+        _Ptr<source_shard_t> shard = &source->shards[i];
+
+        if (shard->sendlist.count < target->sendlist.count)
+            target = shard;
+    }
+    sendlist_add (&target->sendlist, client);
+}
+
+
+/* drop all the shard memberships, used when the clients are taken from
+ * the client_tree by someone else. The client_tree write lock must be held.
+ */
+static void source_shards_forget (_Ptr<source_t> source)
+{
+    unsigned int i;
+
+    for (i = 0; i < source->shard_count; i++)
+        sendlist_clear (&source->shards[i].sendlist);
+}
+
+
+static void source_shards_start (_Ptr<source_t> source, int count)
+{
+    _Array_ptr<source_shard_t> shards : count(count) = NULL;
+    _Ptr<avl_node> node = NULL;
+    unsigned int i;
+
+    if (count <= 1)
+        return;
+    shards = calloc<source_shard_t> (count, sizeof (source_shard_t));
+    if (shards == NULL)
+        return;
+
+    for (i = 0; i < (unsigned int)count; i++)
+    {
+        _Ptr<source_shard_t> shard = &shards[i];
+
+        shard->source = source;
+        thread_mutex_create (&shard->lock);
+        thread_cond_create (&shard->wakeup);
+        thread_cond_create (&shard->finished);
+        shard->running = 1;
+    }
+    avl_tree_wlock (source->client_tree);
+    source->shards = shards, source->shard_count = count;
+    /* spread any listeners already here */
+    node = avl_get_first (source->client_tree);
+    while (node)
+    {
+        _Ptr<client_t> client = avl_get<client_t> (node);
+
+        sendlist_remove (client);
+        source_shards_add (source, client);
+        node = avl_get_next (node);
+    }
+    avl_tree_unlock (source->client_tree);
+
+    /* shard 0 is handled by the source thread */
+    for (i = 1; i < source->shard_count; i++)
+        source->shards[i].thread = thread_create (source_shard_t, void, "Listener Shard",
+                source_shard_thread, &source->shards[i], THREAD_ATTACHED);
+    ICECAST_LOG_INFO("sending to listeners on %s with %u threads", source->mount, source->shard_count);
+}
+
+
+static void source_shards_stop (_Ptr<source_t> source)
+{
+    unsigned int count = source->shard_count;
+    _Array_ptr<source_shard_t> shards : count(count) = source->shards;
+    _Ptr<avl_node> node = NULL;
+    unsigned int i;
+
+    if (count == 0)
+        return;
+
+    for (i = 1; i < count; i++)
+    {
+        _Ptr<source_shard_t> shard = &shards[i];
+
+        thread_mutex_lock (&shard->lock);
+        shard->running = 0;
+        thread_cond_signal (&shard->wakeup);
+        thread_mutex_unlock (&shard->lock);
+        if (shard->thread)
+            thread_join (shard->thread);
+    }
+
+    /* the listeners remain in the client_tree, sent to by the source thread */
+    avl_tree_wlock (source->client_tree);
+    source_shards_forget (source);
+    source->shards = NULL, source->shard_count = 0;
+    node = avl_get_first (source->client_tree);
+    while (node)
+    {
+        sendlist_add (&source->sendlist, avl_get<client_t> (node));
+        node = avl_get_next (node);
+    }
+    avl_tree_unlock (source->client_tree);
+
+    for (i = 0; i < count; i++)
+    {
+        _Ptr<source_shard_t> shard = &shards[i];
+
+        thread_cond_destroy (&shard->wakeup);
+        thread_cond_destroy (&shard->finished);
+        thread_mutex_destroy (&shard->lock);
+    }
+    free<source_shard_t> (shards);
+}
+
+
+/* Listener sockets are watched for write readiness in an edge triggered
+ * epoll set. A client is only marked blocked when a write fails with EAGAIN,
+ * after which it is skipped until the kernel reports the socket writable.
+ * SSL connections can block on reads as well so those are not watched.
+ */
+static void source_watch_client (_Ptr<source_t> source, _Ptr<client_t> client)
+{
+    client->poll_state = CLIENT_POLL_NONE;
+#ifdef HAVE_SYS_EPOLL_H
+    if (source->poll_fd >= 0)
+    {
+        struct epoll_event ev;
+
+#ifdef HAVE_OPENSSL
+        if (client->con->ssl)
+            return;
+#endif
+        memset (&ev, 0, sizeof (ev));
+        ev.events = EPOLLOUT | EPOLLET;
+        ev.data.ptr = (client_t *)client;
+        if (epoll_ctl (source->poll_fd, EPOLL_CTL_ADD, client->con->sock, &ev) == 0)
+            client->poll_state = CLIENT_POLL_READY;
+    }
+#endif
+}
+
+
+static void source_unwatch_client (_Ptr<source_t> source, _Ptr<client_t> client)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (client->poll_state != CLIENT_POLL_NONE && source->poll_fd >= 0)
+    {
+        struct epoll_event ev;
+
+        /* the socket may outlive the client here (auth release), so make
+         * sure no event is left referring to it */
+        memset (&ev, 0, sizeof (ev));
+        epoll_ctl (source->poll_fd, EPOLL_CTL_DEL, client->con->sock, &ev);
+    }
+#endif
+    client->poll_state = CLIENT_POLL_NONE;
+    sendlist_remove (client);
+}
+
+
+/* collect the write readiness reported since the last pass, called from the
+ * source thread with the client_tree write lock held */
+static void source_poll_listeners (_Ptr<source_t> source)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[64];
+    int i, count;
+
+    if (source->poll_fd < 0)
+        return;
+    do
+    {
+        count = epoll_wait (source->poll_fd, events, 64, 0);
+        for (i = 0; i < count; i++)
+        {
+            client_t *client = events[i].data.ptr;
+
+            if (client->poll_state == CLIENT_POLL_BLOCKED)
+            {
+                client->poll_state = CLIENT_POLL_READY;
+                if (client->send_list)
+                    sendlist_move (_Assume_bounds_cast<_Ptr<client_t>>(client), &client->send_list->ready);
+            }
+        }
+    } while (count == 64);
+#endif
+}
+
+
+/* Incoming data is waited for in an epoll set holding the source socket and
+ * the listener poll set, so the source thread wakes as soon as data arrives
+ * or a blocked listener can be written to, instead of on a fixed timeout.
+ * Listener events stay queued in poll_fd until source_poll_listeners picks
+ * them up under the client_tree lock.
+ */
+static void source_watch_ingest (_Ptr<source_t> source)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+    int ret = 0;
+
+    /* a pooled source already has the set, for its kick event */
+    if (source->wait_fd < 0)
+    {
+        if (source->con == NULL || source->poll_fd < 0)
+            return;
+        source->wait_fd = epoll_create (3);
+        if (source->wait_fd < 0)
+            return;
+    }
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    if (source->poll_fd >= 0)
+    {
+        ev.data.fd = source->poll_fd;
+        ret = epoll_ctl (source->wait_fd, EPOLL_CTL_ADD, source->poll_fd, &ev);
+    }
+    if (ret == 0 && source->con)
+    {
+        ev.data.fd = source->con->sock;
+        ret = epoll_ctl (source->wait_fd, EPOLL_CTL_ADD, source->con->sock, &ev);
+    }
+    if (ret == 0)
+        return;
+    ICECAST_LOG_WARN("unable to watch source socket for %s, %s", source->mount, strerror (errno));
+    if (source->kick_fd < 0)
+    {
+        close (source->wait_fd);
+        source->wait_fd = -1;
+    }
+#endif
+}
+
+
+/* wait up to timeout ms, returns > 0 if the source socket has data, 0 on
+ * timeout or when only listeners have become writable, < 0 on error */
+static int source_wait_for_data (_Ptr<source_t> source, int timeout)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[3];
+    int i, count;
+
+    if (source->wait_fd >= 0)
+    {
+        count = epoll_wait (source->wait_fd, events, 3, timeout);
+        for (i = 0; i < count; i++)
+            if (source->con && events[i].data.fd == source->con->sock)
+                return 1;
+        return count < 0 ? count : 0;
+    }
+#endif
+    return util_timed_wait_for_fd (source->con->sock, timeout);
 }
 
 
@@ -626,6 +1176,7 @@ static void source_init (_Ptr<source_t> source)
     char *listenurl;
     _Nt_array_ptr<const char> str = ((void *)0);
     int listen_url_size;
+    int listener_threads = 0;
     _Ptr<mount_proxy> mountinfo = ((void *)0);
 
     /* 6 for max size of port */
@@ -665,7 +1216,7 @@ static void source_init (_Ptr<source_t> source)
 
     /* start off the statistics */
     source->listeners = 0;
-    stats_event_inc (NULL, "source_total_connections");
+    stats_counter_add (NULL, STATS_COUNTER_SOURCE_TOTAL_CONNECTIONS, 1);
     stats_event (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "slow_listeners", "0");
     stats_event_args (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "listeners", "%lu", source->listeners);
     stats_event_args (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "listener_peak", "%lu", source->peak_listeners);
@@ -683,9 +1234,18 @@ static void source_init (_Ptr<source_t> source)
         if (mountinfo->on_connect)
             source_run_script (mountinfo->on_connect, _Assume_bounds_cast<_Ptr<char>>(source->mount));
         auth_stream_start (mountinfo, _Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)));
+        listener_threads = mountinfo->listener_threads;
     }
     config_release_config();
 
+    source_shards_start (source, listener_threads);
+#ifdef HAVE_SYS_EPOLL_H
+    source->poll_fd = epoll_create (64);
+    if (source->poll_fd < 0)
+        ICECAST_LOG_WARN("unable to create listener poll set for %s, %s", source->mount, strerror (errno));
+#endif
+    source_watch_ingest (source);
+
     /*
     ** Now, if we have a fallback source and override is on, we want
     ** to steal its clients, because it means we've come back online
@@ -708,175 +1268,473 @@ static void source_init (_Ptr<source_t> source)
 }
 
 
-void source_main (source_t *source : itype(_Ptr<source_t>))
+/* one pass of the source: read what stream data is available, send to the
+ * listeners and take on any pending ones. Returns 0 once the source is to
+ * finish.
+ */
+static int source_step (_Ptr<source_t> source)
 {
     _Ptr<refbuf_t> refbuf = ((void *)0);
     client_t *client;
     _Ptr<avl_node> client_node = ((void *)0);
+    int remove_from_q;
 
-    source_init (source);
-
-    while (global.running == ICECAST_RUNNING && source->running) {
-        int remove_from_q;
+    if (global.running != ICECAST_RUNNING || source->running == 0)
+        return 0;
 
-        refbuf = get_next_buffer (source);
+    refbuf = get_next_buffer (source);
 
-        remove_from_q = 0;
-        source->short_delay = 0;
+    remove_from_q = 0;
+    source->short_delay = 0;
 
-        if (refbuf)
+    if (refbuf)
+    {
+        /* append buffer to the in-flight data queue,  */
+        if (source->stream_data == NULL)
         {
-            /* append buffer to the in-flight data queue,  */
-            if (source->stream_data == NULL)
-            {
-                source->stream_data = refbuf;
-                source->burst_point = refbuf;
-            }
-            if (source->stream_data_tail)
-                source->stream_data_tail->next = refbuf;
-            source->stream_data_tail = refbuf;
-            source->queue_size += refbuf->len;
-            /* new buffer is referenced for burst */
-            refbuf_addref (refbuf);
-
-            /* new data on queue, so check the burst point */
-            source->burst_offset += refbuf->len;
-            while (source->burst_offset > source->burst_size)
+            source->stream_data = refbuf;
+            source->burst_point = refbuf;
+        }
+        if (source->stream_data_tail)
+            source->stream_data_tail->next = refbuf;
+        source->stream_data_tail = refbuf;
+        source->queue_size += refbuf->len;
+        /* new buffer is referenced for burst */
+        refbuf_addref (refbuf);
+
+        /* new data on queue, so check the burst point */
+        source->burst_offset += refbuf->len;
+        while (source->burst_offset > source->burst_size)
+        {
+            _Ptr<refbuf_t> to_release = source->burst_point;
+
+            if (to_release->next)
             {
-                _Ptr<refbuf_t> to_release = source->burst_point;
-
-                if (to_release->next)
-                {
-                    source->burst_point = to_release->next;
-                    source->burst_offset -= to_release->len;
-                    refbuf_release (to_release);
-                    continue;
-                }
-                break;
+                source->burst_point = to_release->next;
+                source->burst_offset -= to_release->len;
+                refbuf_release (to_release);
+                continue;
             }
+            break;
+        }
 
-            /* save stream to file */
-            _Checked {
-            if (source->dumpfile && source->format->write_buf_to_file)
-                source->format->write_buf_to_file (source, refbuf);
-            }
+        /* save stream to file */
+        _Checked {
+        if (source->dumpfile && source->format->write_buf_to_file)
+            source->format->write_buf_to_file (source, refbuf);
         }
-        /* lets see if we have too much data in the queue, but don't remove it until later */
-        thread_mutex_lock(&source->lock);
-        if (source->queue_size > source->queue_size_limit)
-            remove_from_q = 1;
-        thread_mutex_unlock(&source->lock);
+    }
+    /* lets see if we have too much data in the queue, but don't remove it until later */
+    thread_mutex_lock(&source->lock);
+    if (source->queue_size > source->queue_size_limit)
+        remove_from_q = 1;
+    thread_mutex_unlock(&source->lock);
 
-        /* acquire write lock on pending_tree */
-        avl_tree_wlock(source->pending_tree);
+    /* acquire write lock on pending_tree */
+    avl_tree_wlock(source->pending_tree);
 
-        /* acquire write lock on client_tree */
-        avl_tree_wlock(source->client_tree);
+    /* acquire write lock on client_tree */
+    avl_tree_wlock(source->client_tree);
 
-        client_node = avl_get_first(source->client_tree);
-        while (client_node) {
-            client = avl_get<client_t>(client_node);
+    source_poll_listeners (source);
 
-            send_to_listener (source, _Assume_bounds_cast<_Ptr<client_t>>(client), remove_from_q);
+    if (source->shard_count)
+        source_shards_run (source, remove_from_q);
+    else
+    {
+        source->format->sent_bytes += source_sendlist_run (source, &source->sendlist,
+                remove_from_q, &source->short_delay);
+        source_sendlist_reap (source, &source->sendlist);
+    }
 
-            if (client->con->error) {
-                client_node = avl_get_next(client_node);
-                if (client->respcode == 200)
-                    stats_event_dec (NULL, "listeners");
-                avl_delete<void>(source->client_tree, (void *)client, (_free_client));
-                source->listeners--;
-                ICECAST_LOG_DEBUG("Client removed");
-                continue;
-            }
+    /** add pending clients **/
+    client_node = avl_get_first(source->pending_tree);
+    while (client_node) {
+
+        if(source->max_listeners != -1 && 
+                source->listeners >= (unsigned long)source->max_listeners) 
+        {
+            /* The common case is caught in the main connection handler,
+             * this deals with rarer cases (mostly concerning fallbacks)
+             * and doesn't give the listening client any information about
+             * why they were disconnected
+             */
+            client = avl_get<client_t>(client_node);
             client_node = avl_get_next(client_node);
+            avl_delete<void>(source->pending_tree, (void *)client, (_free_client));
+
+            ICECAST_LOG_INFO("Client deleted, exceeding maximum listeners for this "
+                    "mountpoint (%s).", source->mount);
+            continue;
         }
+        
+        /* Otherwise, the client is accepted, add it */
+        avl_insert<void>(source->client_tree, client_node->key);
+        source_watch_client (source, avl_get<client_t>(client_node));
+        if (source->shard_count)
+            source_shards_add (source, avl_get<client_t>(client_node));
+        else
+            sendlist_add (&source->sendlist, avl_get<client_t>(client_node));
+
+        source->listeners++;
+        ICECAST_LOG_DEBUG("Client added for mountpoint (%s)", source->mount);
+        stats_counter_add (&source->counters, STATS_COUNTER_CONNECTIONS, 1);
+
+        client_node = avl_get_next(client_node);
+    }
+
+    /** clear pending tree **/
+    while (avl_get_first(source->pending_tree)) {
+        avl_delete<void>(source->pending_tree, 
+                avl_get_first(source->pending_tree)->key, 
+                source_remove_client);
+    }
+
+    /* release write lock on pending_tree */
+    avl_tree_unlock(source->pending_tree);
 
-        /** add pending clients **/
-        client_node = avl_get_first(source->pending_tree);
-        while (client_node) {
+    /* update the stats if need be */
+    if (source->listeners != source->prev_listeners)
+    {
+        source->prev_listeners = source->listeners;
+        ICECAST_LOG_INFO("listener count on %s now %lu", source->mount, source->listeners);
+        if (source->listeners > source->peak_listeners)
+        {
+            source->peak_listeners = source->listeners;
+            stats_event_args (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "listener_peak", "%lu", source->peak_listeners);
+        }
+        stats_event_args (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "listeners", "%lu", source->listeners);
+        if (source->listeners == 0 && source->on_demand)
+            source->running = 0;
+    }
 
-            if(source->max_listeners != -1 && 
-                    source->listeners >= (unsigned long)source->max_listeners) 
+    /* lets reduce the queue, any lagging clients should of been
+     * terminated by now
+     */
+    if (source->stream_data)
+    {
+        /* normal unreferenced queue data will have a refcount 1, but
+         * burst queue data will be at least 2, active clients will also
+         * increase refcount. New references to queued data are only
+         * taken under the client_tree lock held here, so a count of 1
+         * cannot rise while we look at it */
+        while (refbuf_count (source->stream_data) == 1)
+        {
+            _Ptr<refbuf_t> to_go = source->stream_data;
+
+            if (to_go->next == NULL || source->burst_point == to_go)
             {
-                /* The common case is caught in the main connection handler,
-                 * this deals with rarer cases (mostly concerning fallbacks)
-                 * and doesn't give the listening client any information about
-                 * why they were disconnected
-                 */
-                client = avl_get<client_t>(client_node);
-                client_node = avl_get_next(client_node);
-                avl_delete<void>(source->pending_tree, (void *)client, (_free_client));
-
-                ICECAST_LOG_INFO("Client deleted, exceeding maximum listeners for this "
-                        "mountpoint (%s).", source->mount);
-                continue;
+                /* this should not happen */
+                ICECAST_LOG_ERROR("queue state is unexpected");
+                source->running = 0;
+                break;
             }
-            
-            /* Otherwise, the client is accepted, add it */
-            avl_insert<void>(source->client_tree, client_node->key);
+            source->stream_data = to_go->next;
+            source->queue_size -= to_go->len;
+            to_go->next = NULL;
+            refbuf_release (to_go);
+        }
+    }
 
-            source->listeners++;
-            ICECAST_LOG_DEBUG("Client added for mountpoint (%s)", source->mount);
-            stats_event_inc(_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "connections");
+    /* release write lock on client_tree */
+    avl_tree_unlock(source->client_tree);
+    return global.running == ICECAST_RUNNING && source->running;
+}
 
-            client_node = avl_get_next(client_node);
-        }
 
-        /** clear pending tree **/
-        while (avl_get_first(source->pending_tree)) {
-            avl_delete<void>(source->pending_tree, 
-                    avl_get_first(source->pending_tree)->key, 
-                    source_remove_client);
+static void source_finish (_Ptr<source_t> source)
+{
+    source_shards_stop (source);
+    source_shutdown (source);
+#ifdef HAVE_SYS_EPOLL_H
+    if (source->wait_fd >= 0)
+        close (source->wait_fd);
+    source->wait_fd = -1;
+    if (source->poll_fd >= 0)
+        close (source->poll_fd);
+    source->poll_fd = -1;
+#endif
+}
+
+
+void source_main (source_t *source : itype(_Ptr<source_t>))
+{
+    source_init (source);
+    while (source_step (source))
+        ;
+    source_finish (source);
+}
+
+
+/* wake a pooled source so that it runs a pass soon, no-op for a source on
+ * its own thread */
+void source_kick (source_t *source : itype(_Ptr<source_t>))
+{
+#ifdef HAVE_SYS_EPOLL_H
+    uint64_t one = 1;
+
+    thread_mutex_lock (&source->lock);
+    if (source->kick_fd >= 0 && write (source->kick_fd, &one, sizeof (one)) < 0)
+        ICECAST_LOG_DEBUG("unable to wake %s, %s", source->mount, strerror (errno));
+    thread_mutex_unlock (&source->lock);
+#endif
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Optional pool of worker threads running the sources, instead of a thread
+ * for each. A pooled source has its wait_fd registered one-shot in the pool
+ * epoll set, so a single worker at a time runs a pass of it whenever stream
+ * data, listener readiness or a kick on its eventfd is pending, and then
+ * re-arms it. The timer kicks every source once a second for the timeout
+ * checks, and fallback files on every tick as those are paced by it.
+ */
+typedef struct source_task_tag
+{
+    _Ptr<source_t> source;
+    void (*done)(_Ptr<source_t> source, void *arg);
+    void *arg;
+    int started;
+    struct source_task_tag *next;
+} source_task_t;
+
+#define SOURCE_POOL_TICK 250    /* ms */
+
+static int pool_fd = -1;
+static volatile int pool_running;
+static unsigned int pool_workers;
+static _Array_ptr<_Ptr<thread_type>> pool_threads : count(pool_workers) = NULL;
+static _Ptr<thread_type> pool_timer = NULL;
+static mutex_t pool_lock;       /* protects pool_tasks */
+static source_task_t *pool_tasks;
+
+
+static void source_pool_unlink (source_task_t *task)
+{
+    source_task_t **trail;
+
+    thread_mutex_lock (&pool_lock);
+    for (trail = &pool_tasks; *trail; trail = &(*trail)->next)
+    {
+        if (*trail == task)
+        {
+            *trail = task->next;
+            break;
         }
+    }
+    thread_mutex_unlock (&pool_lock);
+}
 
-        /* release write lock on pending_tree */
-        avl_tree_unlock(source->pending_tree);
 
-        /* update the stats if need be */
-        if (source->listeners != source->prev_listeners)
+/* hand the source over to the pool, done is called from a worker once the
+ * source has finished. Returns -1 if the pool cannot take it */
+static int source_pool_add (_Ptr<source_t> source, void (*done)(_Ptr<source_t>, void *), void *arg)
+{
+    source_task_t *task;
+    struct epoll_event ev;
+
+    if (pool_fd < 0 || pool_running == 0)
+        return -1;
+    task = calloc<source_task_t> (1, sizeof (source_task_t));
+    if (task == NULL)
+        return -1;
+    task->source = source;
+    task->done = done;
+    task->arg = arg;
+
+    memset (&ev, 0, sizeof (ev));
+    source->wait_fd = epoll_create (3);
+    /* start with a pending kick so the first pass runs straight away */
+    source->kick_fd = eventfd (1, EFD_NONBLOCK);
+    if (source->wait_fd >= 0 && source->kick_fd >= 0)
+    {
+        ev.events = EPOLLIN;
+        ev.data.fd = source->kick_fd;
+        if (epoll_ctl (source->wait_fd, EPOLL_CTL_ADD, source->kick_fd, &ev) == 0)
         {
-            source->prev_listeners = source->listeners;
-            ICECAST_LOG_INFO("listener count on %s now %lu", source->mount, source->listeners);
-            if (source->listeners > source->peak_listeners)
-            {
-                source->peak_listeners = source->listeners;
-                stats_event_args (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "listener_peak", "%lu", source->peak_listeners);
-            }
-            stats_event_args (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "listeners", "%lu", source->listeners);
-            if (source->listeners == 0 && source->on_demand)
-                source->running = 0;
+            thread_mutex_lock (&pool_lock);
+            task->next = pool_tasks;
+            pool_tasks = task;
+            thread_mutex_unlock (&pool_lock);
+
+            ev.events = EPOLLIN | EPOLLONESHOT;
+            ev.data.ptr = task;
+            if (epoll_ctl (pool_fd, EPOLL_CTL_ADD, source->wait_fd, &ev) == 0)
+                return 0;
+            source_pool_unlink (task);
         }
+    }
+    ICECAST_LOG_WARN("unable to add %s to the source pool, %s", source->mount, strerror (errno));
+    if (source->kick_fd >= 0)
+        close (source->kick_fd);
+    source->kick_fd = -1;
+    if (source->wait_fd >= 0)
+        close (source->wait_fd);
+    source->wait_fd = -1;
+    free<source_task_t> (task);
+    return -1;
+}
 
-        /* lets reduce the queue, any lagging clients should of been
-         * terminated by now
-         */
-        if (source->stream_data)
+
+static void source_pool_run (source_task_t *task)
+{
+    _Ptr<source_t> source = task->source;
+    struct epoll_event ev;
+    uint64_t kicks;
+
+    /* clear the kicks, the eventfd does not block */
+    if (read (source->kick_fd, &kicks, sizeof (kicks)) < 0 && errno != EAGAIN)
+        ICECAST_LOG_DEBUG("unable to read kicks for %s, %s", source->mount, strerror (errno));
+
+    if (task->started == 0)
+    {
+        source_init (source);
+        task->started = 1;
+    }
+    if (source_step (source))
+    {
+        if (source->short_delay)
+            source_kick (source);
+        memset (&ev, 0, sizeof (ev));
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = task;
+        if (epoll_ctl (pool_fd, EPOLL_CTL_MOD, source->wait_fd, &ev) == 0)
+            return;
+        ICECAST_LOG_ERROR("unable to rearm %s in the source pool, %s", source->mount, strerror (errno));
+        source->running = 0;
+    }
+    source_pool_unlink (task);
+    thread_mutex_lock (&source->lock);
+    close (source->kick_fd);
+    source->kick_fd = -1;
+    thread_mutex_unlock (&source->lock);
+    /* closing wait_fd here drops it from the pool set */
+    source_finish (source);
+    task->done (source, task->arg);
+    free<source_task_t> (task);
+}
+
+
+static void *source_pool_worker (void *arg)
+{
+    while (1)
+    {
+        struct epoll_event ev;
+
+        if (epoll_wait (pool_fd, &ev, 1, SOURCE_POOL_TICK) > 0)
         {
-            /* normal unreferenced queue data will have a refcount 1, but
-             * burst queue data will be at least 2, active clients will also
-             * increase refcount */
-            while (source->stream_data->_count == 1)
-            {
-                _Ptr<refbuf_t> to_go = source->stream_data;
+            source_pool_run (ev.data.ptr);
+            continue;
+        }
+        if (pool_running == 0)
+        {
+            int idle;
 
-                if (to_go->next == NULL || source->burst_point == to_go)
-                {
-                    /* this should not happen */
-                    ICECAST_LOG_ERROR("queue state is unexpected");
-                    source->running = 0;
-                    break;
-                }
-                source->stream_data = to_go->next;
-                source->queue_size -= to_go->len;
-                to_go->next = NULL;
-                refbuf_release (to_go);
-            }
+            thread_mutex_lock (&pool_lock);
+            idle = pool_tasks == NULL;
+            thread_mutex_unlock (&pool_lock);
+            if (idle)
+                break;
         }
+    }
+    return NULL;
+}
 
-        /* release write lock on client_tree */
-        avl_tree_unlock(source->client_tree);
+
+static void *source_pool_timer (void *arg)
+{
+    unsigned int tick = 0;
+
+    while (1)
+    {
+        source_task_t *task;
+        int idle;
+
+        thread_sleep (SOURCE_POOL_TICK * 1000);
+        tick++;
+        thread_mutex_lock (&pool_lock);
+        for (task = pool_tasks; task; task = task->next)
+        {
+            if (task->source->con == NULL || (tick % (1000/SOURCE_POOL_TICK)) == 0)
+                source_kick (task->source);
+        }
+        idle = pool_tasks == NULL;
+        thread_mutex_unlock (&pool_lock);
+        if (idle && pool_running == 0)
+            break;
     }
-    source_shutdown (source);
+    return NULL;
+}
+#endif
+
+
+void source_pool_initialize (void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    _Ptr<ice_config_t> config = config_get_config ();
+    unsigned int workers = 0, i;
+    _Array_ptr<_Ptr<thread_type>> threads : count(workers) = NULL;
+
+    if (config->source_workers < 0)
+    {
+        long cores = sysconf (_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (unsigned int)cores : 1;
+    }
+    else
+        workers = config->source_workers;
+    config_release_config ();
+    if (workers == 0)
+        return;
+    pool_fd = epoll_create (64);
+    if (pool_fd < 0)
+    {
+        ICECAST_LOG_ERROR("unable to create source pool, %s", strerror (errno));
+        return;
+    }
+    threads = calloc<_Ptr<thread_type>> (workers, sizeof (_Ptr<thread_type>));
+    if (threads == NULL)
+    {
+        close (pool_fd);
+        pool_fd = -1;
+        return;
+    }
+    pool_threads = threads, pool_workers = workers;
+    thread_mutex_create (&pool_lock);
+    pool_running = 1;
+    for (i = 0; i < pool_workers; i++)
+        pool_threads[i] = thread_create (void, void, "Source Worker", source_pool_worker, NULL, THREAD_ATTACHED);
+    pool_timer = thread_create (void, void, "Source Pool Timer", source_pool_timer, NULL, THREAD_ATTACHED);
+    ICECAST_LOG_INFO("running sources on %u worker threads", pool_workers);
+#endif
+}
+
+
+/* wait for the pooled sources to finish, the server is no longer running
+ * at this point so a kick is enough to end each of them */
+void source_pool_shutdown (void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    source_task_t *task;
+    unsigned int i;
+
+    if (pool_fd < 0)
+        return;
+    thread_mutex_lock (&pool_lock);
+    for (task = pool_tasks; task; task = task->next)
+        source_kick (task->source);
+    thread_mutex_unlock (&pool_lock);
+    pool_running = 0;
+
+    for (i = 0; i < pool_workers; i++)
+        thread_join (pool_threads[i]);
+    thread_join (pool_timer);
+    pool_timer = NULL;
+    free<_Ptr<thread_type>> (pool_threads);
+    pool_threads = NULL, pool_workers = 0;
+    close (pool_fd);
+    pool_fd = -1;
+    thread_mutex_destroy (&pool_lock);
+#endif
 }
 
 
@@ -918,6 +1776,7 @@ static void source_shutdown (_Ptr<source_t> source)
 
     /* delete this sources stats */
     stats_event(_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), NULL, NULL);
+    stats_counters_reset (&source->counters);
 
     /* we don't remove the source from the tree here, it may be a relay and
        therefore reserved */
@@ -1001,6 +1860,98 @@ char value _Nt_checked[200];
 
 
 /* Apply the mountinfo details to the source */
+/* Intro files up to this size are held in memory, larger ones are read for
+ * each listener through intro_file */
+#define INTRO_MAX_SIZE  (1024*1024)
+
+/* forget the intro file, both the loaded copy and the open file */
+static void source_drop_intro (_Ptr<source_t> source)
+{
+    _Ptr<refbuf_t> intro;
+    _Ptr<FILE> file;
+
+    thread_mutex_lock (&source->intro_lock);
+    intro = source->intro_data;
+    file = source->intro_file;
+    source->intro_data = NULL;
+    source->intro_file = NULL;
+    thread_mutex_unlock (&source->intro_lock);
+
+    /* listeners part way through keep their own reference */
+    refbuf_release (intro);
+    if (file)
+        fclose (file);
+    free<char> (source->intro_path);
+    source->intro_path = NULL;
+    source->intro_mtime = 0;
+    source->intro_size = 0;
+}
+
+
+/* (re)load the intro file if it has changed since it was last looked at.
+ * Small files become a single shared read-only refbuf that listeners walk
+ * as they do the stream queue, so connecting listeners do not go through
+ * stdio. Listeners already playing the old copy finish it.
+ */
+static void source_check_intro (_Ptr<source_t> source)
+{
+    struct stat st;
+    _Ptr<FILE> f = NULL;
+    _Ptr<refbuf_t> intro = NULL, old_intro;
+    _Ptr<FILE> old_file;
+
+    if (source->intro_path == NULL)
+        return;
+    if (stat (source->intro_path, &st) < 0)
+    {
+        if (source->intro_data == NULL && source->intro_file == NULL)
+            ICECAST_LOG_WARN("Cannot open intro file \"%s\": %s", source->intro_path, strerror(errno));
+        return;
+    }
+    if ((source->intro_data || source->intro_file) &&
+            st.st_mtime == source->intro_mtime && st.st_size == source->intro_size)
+        return;
+
+    f = fopen (source->intro_path, "rb");
+    if (f == NULL)
+    {
+        ICECAST_LOG_WARN("Cannot open intro file \"%s\": %s", source->intro_path, strerror(errno));
+        return;
+    }
+    if (st.st_size > 0 && st.st_size <= INTRO_MAX_SIZE)
+    {
+        /* extra byte for the terminator refbuf_new adds */
+        intro = refbuf_new ((unsigned int)st.st_size + 1);
+        if (fread ((char *)intro->data, 1, st.st_size, f) == (size_t)st.st_size)
+        {
+            intro->len = (unsigned int)st.st_size;
+            fclose (f);
+            f = NULL;
+        }
+        else
+        {
+            refbuf_release (intro);
+            intro = NULL;
+            rewind (f);
+        }
+    }
+    thread_mutex_lock (&source->intro_lock);
+    old_intro = source->intro_data;
+    old_file = source->intro_file;
+    source->intro_data = intro;
+    source->intro_file = f;
+    thread_mutex_unlock (&source->intro_lock);
+
+    refbuf_release (old_intro);
+    if (old_file)
+        fclose (old_file);
+    source->intro_mtime = st.st_mtime;
+    source->intro_size = st.st_size;
+    ICECAST_LOG_DEBUG("intro file %s %s for %s", source->intro_path,
+            intro ? "loaded" : "opened", source->mount);
+}
+
+
 static void source_apply_mount (_Ptr<source_t> source, _Ptr<mount_proxy> mountinfo)
 {
     const char *str;
@@ -1178,11 +2129,6 @@ static void source_apply_mount (_Ptr<source_t> source, _Ptr<mount_proxy> mountin
     else
         source->dumpfilename = NULL;
 
-    if (source->intro_file)
-    {
-        fclose (source->intro_file);
-        source->intro_file = NULL;
-    }
     if (mountinfo && mountinfo->intro_filename)
     {
         _Ptr<ice_config_t> config = config_get_config_unlocked ();
@@ -1191,18 +2137,22 @@ static void source_apply_mount (_Ptr<source_t> source, _Ptr<mount_proxy> mountin
         char *path = malloc<char> (len);
         if (path)
         {
-            _Ptr<FILE> f = ((void *)0);
             snprintf (path, len, "%s" PATH_SEPARATOR "%s", config->webroot_dir,
                     mountinfo->intro_filename);
 
-            f = fopen (path, "rb");
-            if (f)
-                source->intro_file = f;
+            /* a reload of the same unchanged file keeps what is loaded */
+            if (source->intro_path && strcmp (source->intro_path, path) == 0)
+                free<char> (path);
             else
-                ICECAST_LOG_WARN("Cannot open intro file \"%s\": %s", path, strerror(errno));
-            free<char> (path);
+            {
+                source_drop_intro (source);
+                source->intro_path = path;
+            }
+            source_check_intro (source);
         }
     }
+    else
+        source_drop_intro (source);
 
     if (mountinfo && mountinfo->queue_size_limit)
         source->queue_size_limit = mountinfo->queue_size_limit;
@@ -1227,6 +2177,8 @@ static void source_apply_mount (_Ptr<source_t> source, _Ptr<mount_proxy> mountin
 void source_update_settings (ice_config_t *config : itype(_Ptr<ice_config_t>), source_t *source : itype(_Ptr<source_t>), mount_proxy *mountinfo : itype(_Ptr<mount_proxy>))
 {
     thread_mutex_lock(&source->lock);
+    /* stream name and http-headers may have changed */
+    format_reset_headers (source);
     /*  skip if source is a fallback to file */
     if (source->running && source->client == NULL)
     {
@@ -1289,21 +2241,38 @@ void source_update_settings (ice_config_t *config : itype(_Ptr<ice_config_t>), s
 }
 
 
-_Ptr<void> source_client_thread (_Ptr<source_t> source)
+static void source_client_stats (_Ptr<source_t> source)
 {
-
-    stats_event_inc(NULL, "source_client_connections");
+    stats_counter_add (NULL, STATS_COUNTER_SOURCE_CLIENT_CONNECTIONS, 1);
     stats_event (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "listeners", "0");
+}
 
-    source_main (_Assume_bounds_cast<_Ptr<source_t>>(source));
 
-    source_free_source (_Assume_bounds_cast<_Ptr<source_t>>(source));
+static void source_client_done (_Ptr<source_t> source, void *arg)
+{
+    source_free_source (source);
     slave_update_all_mounts();
+}
+
+
+/* run an already counted source client to completion */
+static _Ptr<void> source_run_thread (_Ptr<source_t> source)
+{
+    source_main (_Assume_bounds_cast<_Ptr<source_t>>(source));
+
+    source_client_done (source, NULL);
 
     return NULL;
 }
 
 
+_Ptr<void> source_client_thread (_Ptr<source_t> source)
+{
+    source_client_stats (source);
+    return source_run_thread (source);
+}
+
+
 void source_client_callback (_Ptr<client_t> client, _Ptr<source_t> arg)
 {
     _Nt_array_ptr<const char> agent = ((void *)0);
@@ -1327,7 +2296,12 @@ void source_client_callback (_Ptr<client_t> client, _Ptr<source_t> arg)
     if (agent)
         stats_event (_Assume_bounds_cast<_Nt_array_ptr<const char>>(source->mount, byte_count(0)), "user_agent", agent);
 
-    thread_create(source_t, void, "Source Thread", source_client_thread,
+    source_client_stats (source);
+#ifdef HAVE_SYS_EPOLL_H
+    if (source_pool_add (source, source_client_done, NULL) == 0)
+        return;
+#endif
+    thread_create(source_t, void, "Source Thread", source_run_thread,
             source, THREAD_DETACHED);
 }
 
@@ -1399,6 +2373,13 @@ static void source_run_script (char *command : itype(_Nt_array_ptr<char>), _Ptr<
 #endif
 
 
+static void source_fallback_done (_Ptr<source_t> source, void *arg)
+{
+    source_client_done (source, NULL);
+    httpp_destroy (arg);
+}
+
+
 static void *source_fallback_file (void *arg)
 {
     char *mount = arg;
@@ -1453,7 +2434,12 @@ static void *source_fallback_file (void *arg)
 
         if (connection_complete_source (_Assume_bounds_cast<_Ptr<struct source_tag>>(source), 0) < 0)
             break;
-        source_client_thread(source);
+        source_client_stats (source);
+#ifdef HAVE_SYS_EPOLL_H
+        if (source_pool_add (source, source_fallback_done, parser) == 0)
+            break;
+#endif
+        source_run_thread (source);
         httpp_destroy (parser);
     } while (0);
     if (file)
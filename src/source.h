@@ -17,9 +17,51 @@
 #include "yp.h"
 #include "util.h"
 #include "format.h"
+#include "stats.h"
 #include "thread/thread.h"
 
 #include <stdio.h>
+#include <sys/types.h>
+
+struct source_tag;
+
+/* The listeners a source or shard sends to, split by whether a write can
+ * make progress so that each pass only visits the ones that can. Clients
+ * move to blocked when a write fails with EAGAIN and back to ready when
+ * their socket is reported writable.
+ */
+typedef struct source_sendlist_tag
+{
+    _Ptr<client_t> ready;
+    _Ptr<client_t> blocked;
+    _Ptr<client_t> failed;      /* for the source thread to remove */
+    unsigned int count;
+    time_t last_sweep;          /* blocked listeners last checked */
+} source_sendlist_t;
+
+/* A listener shard is a subset of the listeners on a mount which is written
+ * to by its own worker thread. The shard sets are only changed by the source
+ * thread (or by a holder of the client_tree write lock) and only walked by
+ * the shard worker while the source thread waits for the round to complete.
+ */
+typedef struct source_shard_tag
+{
+    struct source_tag *source : itype(_Ptr<struct source_tag>);
+
+    source_sendlist_t sendlist;
+    thread_type *thread : itype(_Ptr<thread_type>);
+
+    mutex_t lock;       /* protects running, generation and done */
+    cond_t wakeup;      /* generation or running changed, waited on with lock */
+    cond_t finished;    /* done changed, waited on with lock */
+    int running;
+    unsigned int generation;    /* round requested by the source thread */
+    unsigned int done;          /* last round completed by the worker */
+
+    int deletion_expected;
+    int short_delay;
+    uint64_t sent_bytes;
+} source_shard_t;
 
 typedef struct source_tag
 {
@@ -47,6 +89,10 @@ typedef struct source_tag
     util_dict *audio_info : itype(_Ptr<util_dict>);
 
     FILE *intro_file : itype(_Ptr<FILE>);
+    refbuf_t *intro_data : itype(_Ptr<refbuf_t>);  /* intro file contents when small enough */
+    char *intro_path : itype(_Nt_array_ptr<char>);
+    time_t intro_mtime;
+    off_t intro_size;
 
     char *dumpfilename : itype(_Nt_array_ptr<char>); /* Name of a file to dump incoming stream to */
     FILE *dumpfile : itype(_Ptr<FILE>);
@@ -74,10 +120,30 @@ typedef struct source_tag
     int hidden;
     time_t last_read;
     int short_delay;
+    int poll_fd;    /* epoll set for listener write readiness, -1 if unused */
+    int wait_fd;    /* epoll set of the source socket and poll_fd, -1 if unused */
+    int kick_fd;    /* eventfd waking a pooled source, -1 if it has a thread */
 
     refbuf_t *stream_data : itype(_Ptr<refbuf_t>);
     refbuf_t *stream_data_tail : itype(_Ptr<refbuf_t>);
 
+    source_sendlist_t sendlist;     /* when not using shards */
+
+    /* listener fan-out, only used when more than one shard is configured */
+    source_shard_t *shards : itype(_Array_ptr<source_shard_t>) count(shard_count);
+    unsigned int shard_count;
+    mutex_t intro_lock;     /* intro file reads from different shards */
+
+    /* listener response headers as built for header_cache_time, reset when
+     * the settings change */
+    mutex_t header_lock;
+    char *header_cache : itype(_Nt_array_ptr<char>) count(header_cache_len);
+    unsigned int header_cache_len;
+    time_t header_cache_time;
+
+    /* numeric mount stats, see stats_counter_add */
+    stats_counters_t counters;
+
 } source_t;
 
 _Ptr<source_t> source_reserve (const char *mount : itype(_Nt_array_ptr<const char>));
@@ -95,6 +161,9 @@ void source_move_clients (source_t *source : itype(_Ptr<source_t>), source_t *de
 _Itype_for_any(T) int source_remove_client(void *key : itype(_Ptr<T>));
 void source_main(source_t *source : itype(_Ptr<source_t>));
 void source_recheck_mounts (int update_all);
+void source_kick (source_t *source : itype(_Ptr<source_t>));
+void source_pool_initialize (void);
+void source_pool_shutdown (void);
 
 extern mutex_t move_clients_mutex;
 
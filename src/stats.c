@@ -19,6 +19,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
+#ifdef HAVE_POLL
+#include <sys/poll.h>
+#include <unistd.h>
+#endif
 
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
@@ -38,6 +43,7 @@
 #include "stats.h"
 #include "xslt.h"
 #include "util.h"
+#include "fserve.h"
 #define CATMODULE "stats"
 #include "logging.h"
 
@@ -45,6 +51,7 @@
 #define atoll _atoi64
 #define vsnprintf _vsnprintf
 #define snprintf _snprintf
+#define strcasecmp stricmp
 #endif
 
 #define STATS_EVENT_SET     0
@@ -63,9 +70,39 @@ typedef struct _event_queue_tag
 
 #define event_queue_init(qp)    { (qp)->head = NULL; (qp)->tail = &(qp)->head; }
 
+/* one EVENT line queued for a stats listener, the refbuf holding the line
+ * is shared by every listener that was sent the same event */
+typedef struct _stats_message_tag
+{
+    refbuf_t *line : itype(_Ptr<refbuf_t>);
+    unsigned int keylen;    /* length of "EVENT source name ", 0 to never coalesce */
+    unsigned int hash;      /* of the key, when indexed */
+    int indexed;            /* latest queued line for its stat */
+
+    struct _stats_message_tag *next : itype(_Ptr<struct _stats_message_tag>);
+    _Ptr<_Ptr<struct _stats_message_tag>> pprev;
+    _Ptr<struct _stats_message_tag> hash_next;
+} stats_message_t;
+
+/* once this many lines are waiting for a listener, a new value for a stat
+ * replaces any older one still queued */
+#define STATS_LISTENER_BACKLOG  200
+
+/* a listener with this many lines queued on top of the latest value of
+ * each stat can't keep up and is dropped */
+#define STATS_LISTENER_MAX_BACKLOG  2000
+
+/* buckets for finding the latest queued line of a stat */
+#define STATS_LISTENER_HASH     256
+
 typedef struct _event_listener_tag
 {
-    event_queue_t queue;
+    _Ptr<stats_message_t> head;
+    _Ptr<_Ptr<stats_message_t>> tail;
+    _Ptr<stats_message_t> index _Checked[STATS_LISTENER_HASH];
+    unsigned int pending;
+    unsigned int latest;    /* of the pending lines, how many are indexed */
+    int overflow;       /* lines have been dropped, disconnect the client */
     mutex_t mutex;
 
     _Ptr<struct _event_listener_tag> next;
@@ -81,8 +118,42 @@ static mutex_t _stats_mutex;
 static event_queue_t _global_event_queue;
 mutex_t _global_event_mutex;
 
+/* written to when the global queue goes from empty to non-empty, the stats
+ * thread blocks on the read side */
+static int _stats_wake_pipe[2] = { -1, -1 };
+
 static _Ptr<volatile event_listener_t> _event_listeners = ((void *)0);
 
+typedef struct
+{
+    const char *name : itype(_Nt_array_ptr<const char>);
+    int global;     /* published as 0 from startup */
+    int frequent;   /* changes all the time, only sent out every few seconds */
+} stats_counter_info_t;
+
+/* how often frequently changing counters are updated in the stats tree
+ * and sent to stats listeners, unless someone reads the stats */
+#define STATS_FREQUENT_INTERVAL 5
+
+static const stats_counter_info_t _counter_info _Checked[STATS_COUNTER_MAX] =
+{
+    { "connections",                1, 0 },
+    { "listeners",                  1, 0 },
+    { "listener_connections",       1, 0 },
+    { "client_connections",         1, 0 },
+    { "file_connections",           0, 0 },
+    { "stats_connections",          1, 0 },
+    { "source_client_connections",  1, 0 },
+    { "source_relay_connections",   1, 0 },
+    { "source_total_connections",   1, 0 },
+    { "slow_listeners",             0, 0 },
+    { "total_bytes_read",           0, 1 },
+    { "total_bytes_sent",           0, 1 },
+};
+
+static stats_counters_t _global_counters;
+static _Ptr<stats_counters_t> _counters_list = NULL;
+static mutex_t _counters_mutex;
 
 static void *_stats_thread(void *arg);
 static int _compare_stats(void *a, void *b, void *arg);
@@ -94,6 +165,8 @@ static _Ptr<stats_node_t> _find_node(_Ptr<avl_tree> tree, _Nt_array_ptr<const ch
 static _Ptr<stats_source_t> _find_source(_Ptr<avl_tree> tree, _Nt_array_ptr<const char> source);
 static void _free_event(_Ptr<stats_event_t> event);
 static _Ptr<stats_event_t> _get_event_from_queue(_Ptr<event_queue_t> queue);
+static void _sync_counters (int reading);
+static void _free_message (_Ptr<stats_message_t> msg);
 
 
 /* simple helper function for creating an event */
@@ -116,15 +189,32 @@ static _Ptr<stats_event_t> build_event(_Nt_array_ptr<const char> source, _Nt_arr
     return event;
 }
 
+static void _stats_wakeup (void)
+{
+#ifdef HAVE_POLL
+    if (_stats_wake_pipe[1] >= 0 && write (_stats_wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+        ICECAST_LOG_DEBUG("unable to wake stats thread, %s", strerror (errno));
+#endif
+}
+
 static void queue_global_event (_Ptr<stats_event_t> event)
 {
+    int wake;
+
     thread_mutex_lock(&_global_event_mutex);
+    /* the stats thread takes the whole queue, so it only needs telling
+     * when the first event arrives */
+    wake = (_global_event_queue.head == NULL);
     _add_event_to_queue (event, &_global_event_queue);
     thread_mutex_unlock(&_global_event_mutex);
+    if (wake)
+        _stats_wakeup ();
 }
 
 void stats_initialize(void)
 {
+    int n;
+
     _event_listeners = NULL;
 
     /* set up global struct */
@@ -137,6 +227,20 @@ void stats_initialize(void)
     /* set up stats queues */
     event_queue_init (&_global_event_queue);
     thread_mutex_create(&_global_event_mutex);
+#ifdef HAVE_POLL
+    if (pipe (_stats_wake_pipe) == 0)
+    {
+        sock_set_blocking (_stats_wake_pipe[0], 0);
+        sock_set_blocking (_stats_wake_pipe[1], 0);
+    }
+    else
+        _stats_wake_pipe[0] = _stats_wake_pipe[1] = -1;
+#endif
+
+    /* set up the numeric counters */
+    thread_mutex_create(&_counters_mutex);
+    for (n = 0; n < STATS_COUNTER_MAX; n++)
+        _global_counters.published[n] = _global_counters.announced[n] = _counter_info[n].global ? -1 : 0;
 
     /* fire off the stats thread */
     _stats_running = 1;
@@ -152,6 +256,7 @@ void stats_shutdown(void)
 
     /* wait for thread to exit */
     _stats_running = 0;
+    _stats_wakeup ();
     thread_join(_stats_thread_id);
 
     /* wait for other threads to shut down */
@@ -167,6 +272,13 @@ void stats_shutdown(void)
 
     /* destroy the queue mutexes */
     thread_mutex_destroy(&_global_event_mutex);
+    thread_mutex_destroy(&_counters_mutex);
+    if (_stats_wake_pipe[0] >= 0)
+    {
+        close (_stats_wake_pipe[0]);
+        close (_stats_wake_pipe[1]);
+        _stats_wake_pipe[0] = _stats_wake_pipe[1] = -1;
+    }
 
     thread_mutex_destroy(&_stats_mutex);
     avl_tree_free(_stats.source_tree, (_free_source_stats));
@@ -288,6 +400,7 @@ static _Nt_array_ptr<char> _get_stats(_Nt_array_ptr<const char> source, _Nt_arra
     _Nt_array_ptr<char> value = NULL;
 
     thread_mutex_lock(&_stats_mutex);
+    _sync_counters (1);
 
     if (source == NULL) {
         stats = _find_node(_stats.global_tree, name);
@@ -359,6 +472,75 @@ void stats_event_dec(const char *source : itype(_Nt_array_ptr<const char>), cons
     }
 }
 
+/* adjust a numeric counter, NULL counters refers to the global block. Safe
+ * to call from any thread, nothing is queued or locked */
+void stats_counter_add (stats_counters_t *counters : itype(_Ptr<stats_counters_t>), stats_counter_id id, int64_t value)
+{
+    if (counters == NULL)
+        counters = &_global_counters;
+    __atomic_fetch_add (&counters->value[id], value, __ATOMIC_RELAXED);
+}
+
+void stats_counter_set (stats_counters_t *counters : itype(_Ptr<stats_counters_t>), stats_counter_id id, int64_t value)
+{
+    if (counters == NULL)
+        counters = &_global_counters;
+    __atomic_store_n (&counters->value[id], value, __ATOMIC_RELAXED);
+}
+
+/* attach a block of counters to a mountpoint, the mount string must stay
+ * valid until the block is unregistered */
+void stats_counters_register (stats_counters_t *counters : itype(_Ptr<stats_counters_t>), char *mount : itype(_Nt_array_ptr<char>))
+{
+    int i;
+
+    thread_mutex_lock (&_counters_mutex);
+    for (i = 0; i < STATS_COUNTER_MAX; i++)
+    {
+        counters->value[i] = 0;
+        counters->published[i] = 0;
+        counters->announced[i] = 0;
+    }
+    counters->announce_time = 0;
+    counters->mount = mount;
+    counters->next = _counters_list;
+    _counters_list = counters;
+    thread_mutex_unlock (&_counters_mutex);
+}
+
+void stats_counters_unregister (stats_counters_t *counters : itype(_Ptr<stats_counters_t>))
+{
+    _Ptr<_Ptr<stats_counters_t>> prev = &_counters_list;
+
+    thread_mutex_lock (&_counters_mutex);
+    while (*prev)
+    {
+        if (*prev == counters)
+        {
+            *prev = counters->next;
+            break;
+        }
+        prev = (_Ptr<_Ptr<stats_counters_t>>)&(*prev)->next;
+    }
+    counters->next = NULL;
+    thread_mutex_unlock (&_counters_mutex);
+}
+
+/* start the counters again from 0, used when the mount stats are dropped */
+void stats_counters_reset (stats_counters_t *counters : itype(_Ptr<stats_counters_t>))
+{
+    int i;
+
+    thread_mutex_lock (&_counters_mutex);
+    for (i = 0; i < STATS_COUNTER_MAX; i++)
+    {
+        __atomic_store_n (&counters->value[i], 0, __ATOMIC_RELAXED);
+        counters->published[i] = 0;
+        counters->announced[i] = 0;
+    }
+    thread_mutex_unlock (&_counters_mutex);
+}
+
 /* note: you must call this function only when you have exclusive access
 ** to the avl_tree
 */
@@ -412,26 +594,6 @@ static _Ptr<stats_source_t> _find_source(_Ptr<avl_tree> source_tree, _Nt_array_p
     return NULL;
 }
 
-static _Ptr<stats_event_t> _copy_event(_Ptr<stats_event_t> event)
-{
-    _Ptr<stats_event_t> copy = (_Ptr<stats_event_t>)calloc<stats_event_t>(1, sizeof(stats_event_t));
-    if (event->source) 
-        copy->source = (_Nt_array_ptr<char>)strdup(event->source);
-    else
-        copy->source = NULL;
-    if (event->name)
-        copy->name = (_Nt_array_ptr<char>)strdup(event->name);
-    if (event->value)
-        copy->value = (char *)strdup(event->value);
-    else
-        copy->value = NULL;
-    copy->hidden = event->hidden;
-    copy->next = NULL;
-
-    return copy;
-}
-
-
 /* helper to apply specialised changes to a stats node */
 static void modify_node_event (_Ptr<stats_node_t> node, _Ptr<stats_event_t> event)
 {
@@ -661,74 +823,322 @@ void stats_global (ice_config_t *config : itype(_Ptr<ice_config_t>))
 }
 
 
+/* format the EVENT line sent to stats listeners. keylen is set to the
+ * length of the part naming the stat if a later line for the same stat can
+ * replace this one, 0 otherwise */
+static _Ptr<refbuf_t> _serialise_event (_Nt_array_ptr<const char> source, _Nt_array_ptr<const char> name,
+        const char *value, int coalesce, _Ptr<unsigned int> keylen)
+{
+    char buf _Nt_checked[200];
+    _Ptr<refbuf_t> line = NULL;
+    int len, ret;
+
+    len = snprintf (buf, sizeof (buf), "EVENT %s %s ",
+            (source != NULL) ? source : "global",
+            name ? name : "null");
+    if (len <= 0 || len >= (int)sizeof (buf))
+        return NULL;
+    ret = snprintf (buf + len, sizeof (buf) - len, "%s\n", value ? value : "null");
+    if (ret <= 0 || ret >= (int)sizeof (buf) - len)
+        return NULL;
+    *keylen = coalesce ? len : 0;
+    len += ret;
+
+    line = refbuf_new (len);
+    memcpy (line->data, buf, len);
+    return line;
+}
+
+
+/* add a line to a listener queue, taking a reference on it */
+static unsigned int _message_hash (_Ptr<refbuf_t> line, unsigned int keylen)
+{
+    unsigned int hash = 2166136261u;
+    unsigned int i;
+
+    for (i = 0; i < keylen; i++)
+        hash = (hash ^ (unsigned char)line->data[i]) * 16777619u;
+    return hash;
+}
+
+
+/* take a line out of the index. The listener mutex must be held */
+static void _unindex_message (_Ptr<event_listener_t> listener, _Ptr<stats_message_t> msg)
+{
+    _Ptr<_Ptr<stats_message_t>> prev = &listener->index[msg->hash % STATS_LISTENER_HASH];
+
+    while (*prev)
+    {
+        if (*prev == msg)
+        {
+            *prev = msg->hash_next;
+            break;
+        }
+        prev = &(*prev)->hash_next;
+    }
+    msg->hash_next = NULL;
+    msg->indexed = 0;
+    listener->latest--;
+}
+
+
+/* take a line out of the queue, wherever it is. The listener mutex must be held */
+static void _unlink_message (_Ptr<event_listener_t> listener, _Ptr<stats_message_t> msg)
+{
+    if (msg->indexed)
+        _unindex_message (listener, msg);
+    *msg->pprev = msg->next;
+    if (msg->next)
+        msg->next->pprev = msg->pprev;
+    else
+        listener->tail = msg->pprev;
+    msg->next = NULL;
+    msg->pprev = NULL;
+    listener->pending--;
+}
+
+
+static void _queue_message (_Ptr<event_listener_t> listener, _Ptr<refbuf_t> line, unsigned int keylen)
+{
+    _Ptr<stats_message_t> msg = NULL;
+
+    thread_mutex_lock (&listener->mutex);
+    if (listener->overflow)
+    {
+        thread_mutex_unlock (&listener->mutex);
+        return;
+    }
+    msg = calloc<stats_message_t> (1, sizeof (stats_message_t));
+    if (msg == NULL)
+    {
+        thread_mutex_unlock (&listener->mutex);
+        return;
+    }
+    refbuf_addref (line);
+    msg->line = line;
+    msg->keylen = keylen;
+
+    if (keylen)
+    {
+        /* the latest line queued for each stat is kept in the index */
+        _Ptr<_Ptr<stats_message_t>> bucket = NULL;
+        _Ptr<stats_message_t> old = NULL;
+
+        msg->hash = _message_hash (line, keylen);
+        bucket = &listener->index[msg->hash % STATS_LISTENER_HASH];
+        for (old = *bucket; old; old = old->hash_next)
+            if (old->keylen == keylen && memcmp (old->line->data, line->data, keylen) == 0)
+                break;
+        if (old)
+        {
+            /* the client is behind, drop the older value for this stat. The
+             * new line goes on the end so ordering against other stats holds */
+            if (listener->pending >= STATS_LISTENER_BACKLOG)
+            {
+                _unlink_message (listener, old);
+                _free_message (old);
+            }
+            else
+                _unindex_message (listener, old);
+        }
+        msg->hash_next = *bucket;
+        *bucket = msg;
+        msg->indexed = 1;
+        listener->latest++;
+    }
+    msg->pprev = listener->tail;
+    *listener->tail = msg;
+    listener->tail = (_Ptr<_Ptr<stats_message_t>>)&msg->next;
+    listener->pending++;
+    if (listener->pending - listener->latest > STATS_LISTENER_MAX_BACKLOG)
+        listener->overflow = 1;
+    thread_mutex_unlock (&listener->mutex);
+}
+
+
+static _Ptr<stats_message_t> _get_message (_Ptr<event_listener_t> listener)
+{
+    _Ptr<stats_message_t> msg = NULL;
+
+    thread_mutex_lock (&listener->mutex);
+    msg = listener->head;
+    if (msg)
+        _unlink_message (listener, msg);
+    thread_mutex_unlock (&listener->mutex);
+    return msg;
+}
+
+
+static void _free_message (_Ptr<stats_message_t> msg)
+{
+    refbuf_release (msg->line);
+    free<stats_message_t> (msg);
+}
+
+
+/* format an update once and share the line between the listeners' queues.
+ * The _stats_mutex must be held */
+static void _send_to_listeners (_Nt_array_ptr<const char> source, _Nt_array_ptr<const char> name,
+        const char *value, int coalesce)
+{
+    _Ptr<event_listener_t> listener = (_Ptr<event_listener_t>)_event_listeners;
+    _Ptr<refbuf_t> line = NULL;
+    unsigned int keylen = 0;
+
+    if (listener == NULL)
+        return;
+    line = _serialise_event (source, name, value, coalesce, &keylen);
+    while (line && listener) {
+        _queue_message (listener, line, keylen);
+        listener = listener->next;
+    }
+    refbuf_release (line);
+}
+
+
+/* apply an event to the stats tree and pass it on to any listeners, the
+ * event is freed afterwards. The _stats_mutex must be held */
+static void _apply_event (_Ptr<stats_event_t> event)
+{
+    /* check if we are dealing with a global or source event */
+    if (event->source == NULL)
+        process_global_event (event);
+    else
+        process_source_event (event);
+
+    /* now we have an event that's been processed into the running stats,
+     * add and sub events carry the difference rather than the value */
+    _send_to_listeners (event->source, event->name, event->value,
+            event->action != STATS_EVENT_ADD && event->action != STATS_EVENT_SUB);
+
+    /* now we need to destroy the event */
+    _free_event(event);
+}
+
+
+/* bring the tree and the stats listeners up to date with a block of
+ * counters. Frequent counters are only dealt with every few seconds, or
+ * in the tree when it is about to be read */
+static void _sync_counter_block (_Ptr<stats_counters_t> counters, time_t now, int reading)
+{
+    int due = (now >= counters->announce_time);
+    int i;
+
+    for (i = 0; i < STATS_COUNTER_MAX; i++)
+    {
+        int64_t value = __atomic_load_n (&counters->value[i], __ATOMIC_RELAXED);
+        int frequent = _counter_info[i].frequent;
+        char buf _Nt_checked[24];
+
+        if (value == counters->announced[i] && value == counters->published[i])
+            continue;
+        if (frequent && due == 0 && reading == 0)
+            continue;
+        snprintf (buf, sizeof (buf), "%" PRId64, value);
+        if (value != counters->published[i])
+        {
+            /* set the value in place, no event needs to be built */
+            stats_event_t event = { 0 };
+
+            event.source = counters->mount;
+            event.name = (_Nt_array_ptr<char>)_counter_info[i].name;
+            event.value = buf;
+            event.action = STATS_EVENT_SET;
+            if (event.source == NULL)
+                process_global_event (&event);
+            else
+                process_source_event (&event);
+            counters->published[i] = value;
+        }
+        if (frequent && due == 0)
+            continue;
+        if (counters->published[i] != counters->announced[i])
+        {
+            _send_to_listeners (counters->mount, _counter_info[i].name, buf, 1);
+            counters->announced[i] = counters->published[i];
+        }
+    }
+    if (due)
+        counters->announce_time = now + STATS_FREQUENT_INTERVAL;
+}
+
+/* fold any counters that have moved into the stats tree, reading is set
+ * when the tree is about to be read so every counter has to be current.
+ * The _stats_mutex must be held */
+static void _sync_counters (int reading)
+{
+    _Ptr<stats_counters_t> counters = NULL;
+    time_t now = time (NULL);
+
+    thread_mutex_lock (&_counters_mutex);
+    _sync_counter_block (&_global_counters, now, reading);
+    for (counters = _counters_list; counters; counters = counters->next)
+        _sync_counter_block (counters, now, reading);
+    thread_mutex_unlock (&_counters_mutex);
+}
+
+
+/* block until more events are queued, the timeout lets the counters be
+ * published regularly even when nothing else is happening */
+static void _stats_wait (void)
+{
+#ifdef HAVE_POLL
+    if (_stats_wake_pipe[0] >= 0)
+    {
+        struct pollfd pfd;
+        char buf[64];
+
+        pfd.fd = _stats_wake_pipe[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll (&pfd, 1, 1000) > 0)
+        {
+            /* drain before the queue is taken, so a later event always
+             * leaves something to wake on */
+            while (read (_stats_wake_pipe[0], buf, sizeof (buf)) > 0)
+                ;
+        }
+        return;
+    }
+#endif
+    thread_sleep(300000);
+}
+
+
 static void *_stats_thread(void *arg)
 {
     _Ptr<stats_event_t> event = ((void *)0);
-    _Ptr<stats_event_t> copy = ((void *)0);
-    _Ptr<event_listener_t> listener = ((void *)0);
 
     stats_event_time (NULL, "server_start");
     stats_event_time_iso8601 (NULL, "server_start_iso8601");
 
-    /* global currently active stats */
+    /* global currently active stats, the counters publish themselves */
     stats_event (NULL, "clients", "0");
-    stats_event (NULL, "connections", "0");
     stats_event (NULL, "sources", "0");
     stats_event (NULL, "stats", "0");
-    stats_event (NULL, "listeners", "0");
-
-    /* global accumulating stats */
-    stats_event (NULL, "client_connections", "0");
-    stats_event (NULL, "source_client_connections", "0");
-    stats_event (NULL, "source_relay_connections", "0");
-    stats_event (NULL, "source_total_connections", "0");
-    stats_event (NULL, "stats_connections", "0");
-    stats_event (NULL, "listener_connections", "0");
 
     ICECAST_LOG_INFO("stats thread started");
     while (_stats_running) {
-        thread_mutex_lock(&_global_event_mutex);
-        if (_global_event_queue.head != NULL) {
-            /* grab the next event from the queue */
-            event = _get_event_from_queue (&_global_event_queue);
-            thread_mutex_unlock(&_global_event_mutex);
-
-            if (event == NULL)
-                continue;
-            event->next = NULL;
-
-            thread_mutex_lock(&_stats_mutex);
+        _Ptr<stats_event_t> batch = NULL;
 
-            /* check if we are dealing with a global or source event */
-            if (event->source == NULL)
-                process_global_event (event);
-            else
-                process_source_event (event);
-            
-            /* now we have an event that's been processed into the running stats */
-            /* this event should get copied to event listeners' queues */
-            listener = (_Ptr<event_listener_t>)_event_listeners;
-            while (listener) {
-                copy = _copy_event(event);
-                thread_mutex_lock (&listener->mutex);
-                _add_event_to_queue (copy, &listener->queue);
-                thread_mutex_unlock (&listener->mutex);
-
-                listener = listener->next;
-            }
-
-            /* now we need to destroy the event */
-            _free_event(event);
+        /* take everything queued so far in one go */
+        thread_mutex_lock(&_global_event_mutex);
+        batch = (_Ptr<stats_event_t>)_global_event_queue.head;
+        event_queue_init (&_global_event_queue);
+        thread_mutex_unlock(&_global_event_mutex);
 
-            thread_mutex_unlock(&_stats_mutex);
-            continue;
-        }
-        else
+        thread_mutex_lock(&_stats_mutex);
+        while (batch)
         {
-            thread_mutex_unlock(&_global_event_mutex);
+            event = batch;
+            batch = event->next;
+            event->next = NULL;
+            _apply_event (event);
         }
+        _sync_counters (0);
+        thread_mutex_unlock(&_stats_mutex);
 
-        thread_sleep(300000);
+        _stats_wait ();
     }
 
     return NULL;
@@ -753,24 +1163,6 @@ static void _unregister_listener(_Ptr<event_listener_t> listener)
 }
 
 
-static _Ptr<stats_event_t> _make_event_from_node(_Ptr<stats_node_t> node, _Nt_array_ptr<char> source)
-{
-    _Ptr<stats_event_t> event = (_Ptr<stats_event_t>)malloc<stats_event_t>(sizeof(stats_event_t));
-    
-    if (source != NULL)
-        event->source = (_Nt_array_ptr<char>)strdup(source);
-    else
-        event->source = NULL;
-    event->name = (_Nt_array_ptr<char>)strdup(node->name);
-    event->value = (char *)strdup(node->value);
-    event->hidden = node->hidden;
-    event->action = STATS_EVENT_SET;
-    event->next = NULL;
-
-    return event;
-}
-
-
 static void _add_event_to_queue(_Ptr<stats_event_t> event, _Ptr<event_queue_t> queue)
 {
     *queue->tail = event;
@@ -793,33 +1185,13 @@ static _Ptr<stats_event_t> _get_event_from_queue(_Ptr<event_queue_t> queue)
     return event;
 }
 
-static int _send_event_to_client(_Ptr<stats_event_t> event, _Ptr<client_t> client)
-{
-    int len;
-    char buf _Nt_checked[200];
-
-    /* send data to the client!!!! */
-    len = snprintf (buf, sizeof (buf), "EVENT %s %s %s\n",
-            (event->source != NULL) ? event->source : "global",
-            event->name ? event->name : "null",
-            event->value ? event->value : "null");
-    if (len > 0 && len < (int)sizeof (buf))
-    {
-        _Nt_array_ptr<char> tmp : count(len) = _Assume_bounds_cast<_Nt_array_ptr<char>>(buf, count(len));
-        client_send_bytes<char>(client, tmp, len);
-        if (client->con->error)
-            return -1;
-    }
-    return 0;
-}
-
-
 static xmlNodePtr _dump_stats_to_doc (xmlNodePtr root, _Nt_array_ptr<const char> show_mount, int hidden)
 {
     _Ptr<avl_node> avlnode = ((void *)0);
     xmlNodePtr ret = NULL;
 
     thread_mutex_lock(&_stats_mutex);
+    _sync_counters (1);
     /* general stats first */
     avlnode = avl_get_first(_stats.global_tree);
     while (avlnode)
@@ -857,6 +1229,21 @@ static xmlNodePtr _dump_stats_to_doc (xmlNodePtr root, _Nt_array_ptr<const char>
 }
 
 
+/* queue the current value of a stat on a listener that is not yet
+ * registered, so nothing else can reach its queue */
+static void _queue_node (_Ptr<event_listener_t> listener, _Nt_array_ptr<const char> source, _Ptr<stats_node_t> node)
+{
+    unsigned int keylen = 0;
+    _Ptr<refbuf_t> line = _serialise_event (source, _Assume_bounds_cast<_Nt_array_ptr<const char>>(node->name, byte_count(0)),
+            node->value, 1, &keylen);
+
+    if (line)
+    {
+        _queue_message (listener, line, keylen);
+        refbuf_release (line);
+    }
+}
+
 /* factoring out code for stats loops
 ** this function copies all stats to queue, and registers 
 ** the queue for all new events atomically.
@@ -866,18 +1253,17 @@ static void _register_listener (_Ptr<event_listener_t> listener)
 {
     _Ptr<avl_node> node = ((void *)0);
     _Ptr<avl_node> node2 = ((void *)0);
-    _Ptr<stats_event_t> event = ((void *)0);
     _Ptr<stats_source_t> source = ((void *)0);
 
     thread_mutex_lock(&_stats_mutex);
+    _sync_counters (1);
 
     /* first we fill our queue with the current stats */
     
     /* start with the global stats */
     node = avl_get_first(_stats.global_tree);
     while (node) {
-        event = _make_event_from_node(avl_get<stats_node_t>(node), NULL);
-        _add_event_to_queue (event, &listener->queue);
+        _queue_node (listener, NULL, avl_get<stats_node_t>(node));
 
         node = avl_get_next(node);
     }
@@ -888,8 +1274,8 @@ static void _register_listener (_Ptr<event_listener_t> listener)
         source = avl_get<stats_source_t>(node);
         node2 = avl_get_first(source->stats_tree);
         while (node2) {
-            event = _make_event_from_node(avl_get<stats_node_t>(node2), _Assume_bounds_cast<_Nt_array_ptr<char>>(source->source, byte_count(0)));
-            _add_event_to_queue (event, &listener->queue);
+            _queue_node (listener, _Assume_bounds_cast<_Nt_array_ptr<const char>>(source->source, byte_count(0)),
+                    avl_get<stats_node_t>(node2));
 
             node2 = avl_get_next(node2);
         }
@@ -907,12 +1293,13 @@ static void _register_listener (_Ptr<event_listener_t> listener)
 _Ptr<char> stats_connection(_Ptr<client_t> arg)
 {
     _Ptr<client_t> client = (_Ptr<client_t>)arg;
-    _Ptr<stats_event_t> event = ((void *)0);
+    _Ptr<stats_message_t> msg = NULL;
     event_listener_t listener = {};
 
     ICECAST_LOG_INFO("stats client starting");
 
-    event_queue_init (&listener.queue);
+    listener.head = NULL;
+    listener.tail = &listener.head;
     /* increment the thread count */
     thread_mutex_lock(&_stats_mutex);
     _stats_threads++;
@@ -924,15 +1311,18 @@ _Ptr<char> stats_connection(_Ptr<client_t> arg)
     _register_listener (&listener);
 
     while (_stats_running) {
-        thread_mutex_lock (&listener.mutex);
-        event = _get_event_from_queue (&listener.queue);
-        thread_mutex_unlock (&listener.mutex);
-        if (event != NULL) {
-            if (_send_event_to_client(event, client) < 0) {
-                _free_event(event);
+        if (listener.overflow) {
+            ICECAST_LOG_WARN("stats client too far behind, dropping");
+            break;
+        }
+        msg = _get_message (&listener);
+        if (msg != NULL) {
+            _Ptr<refbuf_t> line = msg->line;
+
+            client_send_bytes<char> (client, line->data, line->len);
+            _free_message (msg);
+            if (client->con->error)
                 break;
-            }
-            _free_event(event);
             continue;
         }
         thread_sleep (500000);
@@ -944,6 +1334,8 @@ _Ptr<char> stats_connection(_Ptr<client_t> arg)
     stats_event_args (NULL, "stats", "%d", _stats_threads);
     thread_mutex_unlock(&_stats_mutex);
 
+    while ((msg = _get_message (&listener)))
+        _free_message (msg);
     thread_mutex_destroy (&listener.mutex);
     client_destroy (client);
     ICECAST_LOG_INFO("stats client finished");
@@ -975,9 +1367,17 @@ typedef struct _source_xml_tag {
 void stats_transform_xslt(client_t *client : itype(_Ptr<client_t>), const char *uri : itype(_Nt_array_ptr<const char>))
 {
     xmlDocPtr doc = NULL;
-    _Nt_array_ptr<char> xslpath = ((_Nt_array_ptr<char> )util_get_path_from_normalised_uri (uri));
+    _Nt_array_ptr<char> xslpath = NULL;
     _Nt_array_ptr<const char> mount = (_Nt_array_ptr<const char>) httpp_get_query_param (client->parser, "mount");
 
+    /* the JSON status is written directly rather than through xml2json.xslt */
+    if (strcmp (uri, "/status-json.xsl") == 0)
+    {
+        stats_send_json (client, mount);
+        return;
+    }
+
+    xslpath = ((_Nt_array_ptr<char> )util_get_path_from_normalised_uri (uri));
     doc = stats_get_xml (0, mount);
 
     xslt_transform(doc, xslpath, client);
@@ -1092,6 +1492,439 @@ _Ptr<refbuf_t> cur = start;
 
 
 
+/* response body built straight from the stats tree into a chain of
+ * refbufs, so the size does not need to be known up front */
+#define STATS_OUTPUT_BLKSIZE    4096
+
+typedef struct
+{
+    _Ptr<refbuf_t> head;
+    _Ptr<refbuf_t> cur;
+    unsigned int size;      /* of cur, the last byte is kept for the nul */
+    unsigned int used;
+    size_t total;
+} stats_output_t;
+
+static void _output_init (_Ptr<stats_output_t> out)
+{
+    out->head = out->cur = refbuf_new (STATS_OUTPUT_BLKSIZE);
+    out->size = STATS_OUTPUT_BLKSIZE;
+    out->used = 0;
+    out->total = 0;
+}
+
+static void _output_printf (_Ptr<stats_output_t> out, const char *format, ...)
+{
+    while (1)
+    {
+        unsigned int space = out->size - out->used;
+        va_list ap;
+        int ret;
+
+        va_start (ap, format);
+        ret = vsnprintf (out->cur->data + out->used, space, format, ap);
+        va_end (ap);
+        if (ret < 0)
+            return;
+        if ((unsigned int)ret < space)
+        {
+            out->used += ret;
+            out->total += ret;
+            return;
+        }
+        /* does not fit, close this block and start another big enough */
+        out->cur->len = out->used;
+        out->size = (unsigned int)ret + 1 > STATS_OUTPUT_BLKSIZE ? (unsigned int)ret + 1 : STATS_OUTPUT_BLKSIZE;
+        out->cur->next = refbuf_new (out->size);
+        out->cur = out->cur->next;
+        out->used = 0;
+    }
+}
+
+static void _output_free (_Ptr<stats_output_t> out)
+{
+    while (out->head)
+    {
+        _Ptr<refbuf_t> to_go = out->head;
+        out->head = to_go->next;
+        to_go->next = NULL;
+        refbuf_release (to_go);
+    }
+}
+
+/* send the body with a Content-Length so the connection can be kept open,
+ * the fserve thread then writes out the chain */
+static void _output_send (_Ptr<stats_output_t> out, _Ptr<client_t> client, _Nt_array_ptr<const char> contenttype)
+{
+    _Ptr<refbuf_t> refbuf = refbuf_new (PER_CLIENT_REFBUF_SIZE);
+    ssize_t ret;
+
+    out->cur->len = out->used;
+    ret = util_http_build_header (refbuf->data, PER_CLIENT_REFBUF_SIZE, 0, 0, 200, NULL,
+            contenttype, "utf-8", NULL, NULL, client);
+    if (ret > 0 && ret < PER_CLIENT_REFBUF_SIZE)
+        ret += snprintf (refbuf->data + ret, PER_CLIENT_REFBUF_SIZE - ret,
+                "Content-Length: %lu\r\n\r\n", (unsigned long)out->total);
+    if (ret <= 0 || ret >= PER_CLIENT_REFBUF_SIZE)
+    {
+        ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+        refbuf_release (refbuf);
+        _output_free (out);
+        client_send_500 (client, "Header generation failed.");
+        return;
+    }
+    client->respcode = 200;
+    client_set_queue (client, NULL);
+    client->refbuf = refbuf;
+    refbuf_widen (client->refbuf);
+    client->refbuf->next = out->head;
+    out->head = NULL;
+    fserve_add_client (client, NULL);
+}
+
+
+typedef struct
+{
+    const char *name : itype(_Nt_array_ptr<const char>);
+    int counter;
+} stats_metric_t;
+
+/* stats exported as metrics, anything not listed or not an integer is
+ * left out */
+static const stats_metric_t _global_metrics _Checked[] =
+{
+    { "client_connections",         1 },
+    { "clients",                    0 },
+    { "connections",                1 },
+    { "file_connections",           1 },
+    { "listener_connections",       1 },
+    { "listeners",                  0 },
+    { "refbuf_allocs",              1 },
+    { "refbuf_bytes_retained",      0 },
+    { "refbuf_hits",                1 },
+    { "source_client_connections",  1 },
+    { "source_relay_connections",   1 },
+    { "source_total_connections",   1 },
+    { "sources",                    0 },
+    { "ssl_session_hits",           1 },
+    { "ssl_session_misses",         1 },
+    { "ssl_session_timeouts",       1 },
+    { "ssl_sessions_cached",        0 },
+    { "stats",                      0 },
+    { "stats_connections",          1 },
+    { NULL, 0 }
+};
+
+static const stats_metric_t _source_metrics _Checked[] =
+{
+    { "audio_bitrate",              0 },
+    { "audio_channels",             0 },
+    { "audio_samplerate",           0 },
+    { "connections",                1 },
+    { "listener_connections",       1 },
+    { "listener_peak",              0 },
+    { "listeners",                  0 },
+    { "max_listeners",              0 },
+    { "slow_listeners",             1 },
+    { "total_bytes_read",           1 },
+    { "total_bytes_sent",           1 },
+    { NULL, 0 }
+};
+
+static int _metric_value (_Ptr<stats_node_t> stat, _Ptr<long long> value)
+{
+    char *end = NULL;
+
+    if (stat == NULL || stat->value == NULL)
+        return -1;
+    errno = 0;
+    *value = strtoll (stat->value, &end, 10);
+    if (end == stat->value || *end != '\0' || errno)
+        return -1;
+    return 0;
+}
+
+static void _metric_type (_Ptr<stats_output_t> out, _Nt_array_ptr<const char> prefix, _Ptr<const stats_metric_t> metric)
+{
+    _output_printf (out, "# TYPE %s%s %s\n", prefix, metric->name, metric->counter ? "counter" : "gauge");
+}
+
+/* mountpoints as a label value, with \, " and newline escaped */
+static int _metric_label (_Nt_array_ptr<char> buf : count(len), size_t len, _Nt_array_ptr<const char> value)
+{
+    size_t pos = 0;
+
+    for (; *value; value++)
+    {
+        if (pos + 2 >= len)
+            return -1;
+        if (*value == '\\' || *value == '"')
+            buf[pos++] = '\\';
+        else if (*value == '\n')
+        {
+            buf[pos++] = '\\';
+            buf[pos++] = 'n';
+            continue;
+        }
+        buf[pos++] = *value;
+    }
+    buf[pos] = '\0';
+    return 0;
+}
+
+/* write the stats as OpenMetrics text. Samples of one metric have to be
+ * grouped, so the mounts are walked once for each source metric */
+static void _write_metrics (_Ptr<stats_output_t> out)
+{
+    _Ptr<const stats_metric_t> metric = NULL;
+
+    thread_mutex_lock (&_stats_mutex);
+    _sync_counters (1);
+
+    for (metric = _global_metrics; metric->name; metric++)
+    {
+        _Ptr<stats_node_t> stat = _find_node (_stats.global_tree, metric->name);
+        long long value;
+
+        if (stat == NULL || stat->hidden > 0 || _metric_value (stat, &value) < 0)
+            continue;
+        _metric_type (out, "icecast_", metric);
+        _output_printf (out, "icecast_%s%s %lld\n", metric->name, metric->counter ? "_total" : "", value);
+    }
+
+    for (metric = _source_metrics; metric->name; metric++)
+    {
+        _Ptr<avl_node> node = avl_get_first (_stats.source_tree);
+        int typed = 0;
+
+        while (node)
+        {
+            _Ptr<stats_source_t> source = avl_get<stats_source_t>(node);
+            char label _Nt_checked[512];
+            long long value;
+
+            node = avl_get_next (node);
+            if (source->hidden > 0)
+                continue;
+            if (_metric_value (_find_node (source->stats_tree, metric->name), &value) < 0)
+                continue;
+            if (_metric_label (label, sizeof (label) - 1, _Assume_bounds_cast<_Nt_array_ptr<const char>>(source->source, byte_count(0))) < 0)
+                continue;
+            if (typed == 0)
+            {
+                _metric_type (out, "icecast_source_", metric);
+                typed = 1;
+            }
+            _output_printf (out, "icecast_source_%s%s{mount=\"%s\"} %lld\n",
+                    metric->name, metric->counter ? "_total" : "", label, value);
+        }
+    }
+    thread_mutex_unlock (&_stats_mutex);
+
+    _output_printf (out, "# EOF\n");
+}
+
+void stats_send_metrics (client_t *client : itype(_Ptr<client_t>))
+{
+    stats_output_t out;
+
+    _output_init (&out);
+    _write_metrics (&out);
+    _output_send (&out, client, "application/openmetrics-text; version=1.0.0");
+}
+
+
+/* status-json.xsl used to be the stats XML run through xml2json.xslt, the
+ * JSON is now written directly in the same layout. These are the stats
+ * its stylesheet left out */
+static int _json_hidden (_Nt_array_ptr<const char> name, int global)
+{
+    if (strstr (name, "connections"))
+        return 1;
+    if (global)
+        return strcmp (name, "sources") == 0 || strcmp (name, "clients") == 0 ||
+            strcmp (name, "stats") == 0 || strcmp (name, "listeners") == 0;
+    return strcmp (name, "max_listeners") == 0 || strcmp (name, "public") == 0 ||
+        strcmp (name, "source_ip") == 0 || strcmp (name, "slow_listeners") == 0 ||
+        strstr (name, "total_bytes") != NULL || strcmp (name, "user_agent") == 0;
+}
+
+static void _json_string (_Ptr<stats_output_t> out, const char *str)
+{
+    const char *run = str;
+
+    _output_printf (out, "\"");
+    for (; *str; str++)
+    {
+        unsigned char c = (unsigned char)*str;
+        const char *escape = NULL;
+        char code[8];
+
+        switch (c)
+        {
+            case '\\': escape = "\\\\"; break;
+            case '"':  escape = "\\\""; break;
+            case '\t': escape = "\\t"; break;
+            case '\n': escape = "\\n"; break;
+            case '\r': escape = "\\r"; break;
+            default:
+                if (c >= 0x20)
+                    continue;
+                snprintf (code, sizeof (code), "\\u%04x", c);
+                escape = code;
+                break;
+        }
+        if (str > run)
+            _output_printf (out, "%.*s", (int)(str - run), run);
+        _output_printf (out, "%s", escape);
+        run = str + 1;
+    }
+    if (str > run)
+        _output_printf (out, "%.*s", (int)(str - run), run);
+    _output_printf (out, "\"");
+}
+
+/* bare numbers, but only ones that are valid JSON */
+static int _json_number (const char *str)
+{
+    if (*str == '-')
+        str++;
+    if (*str < '0' || *str > '9' || (str[0] == '0' && str[1] >= '0' && str[1] <= '9'))
+        return 0;
+    while (*str >= '0' && *str <= '9')
+        str++;
+    if (*str == '.')
+    {
+        str++;
+        if (*str < '0' || *str > '9')
+            return 0;
+        while (*str >= '0' && *str <= '9')
+            str++;
+    }
+    return *str == '\0';
+}
+
+static void _json_value (_Ptr<stats_output_t> out, const char *value)
+{
+    if (value == NULL || value[strspn (value, " \t\r\n")] == '\0')
+        _output_printf (out, "null");
+    else if (strcasecmp (value, "true") == 0)
+        _output_printf (out, "true");
+    else if (strcasecmp (value, "false") == 0)
+        _output_printf (out, "false");
+    else if (_json_number (value))
+        _output_printf (out, "%s", value);
+    else
+        _json_string (out, value);
+}
+
+/* one "name":value member, with the separating comma when needed */
+static void _json_member (_Ptr<stats_output_t> out, _Ptr<stats_node_t> stat, _Ptr<int> first)
+{
+    if (*first == 0)
+        _output_printf (out, ",");
+    *first = 0;
+    _json_string (out, stat->name);
+    _output_printf (out, ":");
+    _json_value (out, stat->value);
+}
+
+/* the stylesheet put a dummy member at the end when the last stat was one
+ * it left out */
+static void _json_close (_Ptr<stats_output_t> out, int first, int trailing_hidden)
+{
+    if (trailing_hidden)
+        _output_printf (out, "%s\"dummy\":null", first ? "" : ",");
+    _output_printf (out, "}");
+}
+
+static void _json_source (_Ptr<stats_output_t> out, _Ptr<stats_source_t> source)
+{
+    _Ptr<avl_node> node = avl_get_first (source->stats_tree);
+    int first = 1, trailing_hidden = 0;
+
+    if (node == NULL)
+    {
+        _output_printf (out, "null");
+        return;
+    }
+    _output_printf (out, "{");
+    for (; node; node = avl_get_next (node))
+    {
+        _Ptr<stats_node_t> stat = avl_get<stats_node_t>(node);
+
+        trailing_hidden = _json_hidden (_Assume_bounds_cast<_Nt_array_ptr<const char>>(stat->name, byte_count(0)), 0);
+        if (trailing_hidden == 0)
+            _json_member (out, stat, &first);
+    }
+    _json_close (out, first, trailing_hidden);
+}
+
+static int _json_show_source (_Ptr<stats_source_t> source, _Nt_array_ptr<const char> show_mount)
+{
+    return source->hidden <= 0 && (show_mount == NULL || strcmp (show_mount, source->source) == 0);
+}
+
+/* the same stats as stats_get_xml (0, show_mount) gives */
+static void _write_json (_Ptr<stats_output_t> out, _Nt_array_ptr<const char> show_mount)
+{
+    _Ptr<avl_node> node = NULL;
+    int first = 1, trailing_hidden = 0, sources = 0;
+
+    thread_mutex_lock (&_stats_mutex);
+    _sync_counters (1);
+
+    _output_printf (out, "{\"icestats\":{");
+    for (node = avl_get_first (_stats.global_tree); node; node = avl_get_next (node))
+    {
+        _Ptr<stats_node_t> stat = avl_get<stats_node_t>(node);
+
+        if (stat->hidden > 0)
+            continue;
+        trailing_hidden = _json_hidden (_Assume_bounds_cast<_Nt_array_ptr<const char>>(stat->name, byte_count(0)), 1);
+        if (trailing_hidden == 0)
+            _json_member (out, stat, &first);
+    }
+
+    for (node = avl_get_first (_stats.source_tree); node; node = avl_get_next (node))
+        if (_json_show_source (avl_get<stats_source_t>(node), show_mount))
+            sources++;
+    if (sources)
+    {
+        int count = 0;
+
+        _output_printf (out, "%s\"source\":%s", first ? "" : ",", sources > 1 ? "[" : "");
+        for (node = avl_get_first (_stats.source_tree); node; node = avl_get_next (node))
+        {
+            _Ptr<stats_source_t> source = avl_get<stats_source_t>(node);
+
+            if (_json_show_source (source, show_mount) == 0)
+                continue;
+            if (count++)
+                _output_printf (out, ",");
+            _json_source (out, source);
+        }
+        if (sources > 1)
+            _output_printf (out, "]");
+        first = 0;
+        trailing_hidden = 0;
+    }
+    thread_mutex_unlock (&_stats_mutex);
+
+    _json_close (out, first, trailing_hidden);
+    _output_printf (out, "}\n");
+}
+
+void stats_send_json (client_t *client : itype(_Ptr<client_t>), const char *show_mount : itype(_Nt_array_ptr<const char>))
+{
+    stats_output_t out;
+
+    _output_init (&out);
+    _write_json (&out, show_mount);
+    _output_send (&out, client, "application/json");
+}
+
+
 /* This removes any source stats from virtual mountpoints, ie mountpoints
  * where no source_t exists. This function requires the global sources lock
  * to be held before calling.
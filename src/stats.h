@@ -71,6 +71,39 @@ typedef struct _stats_tag
 
 } stats_t;
 
+/* numeric stats updated from the hot paths. These are plain 64bit counters
+ * bumped atomically by whichever thread sees the activity, the stats thread
+ * folds any that have moved into the stats tree, so counting never allocates
+ * an event or takes a lock. */
+typedef enum
+{
+    STATS_COUNTER_CONNECTIONS = 0,
+    STATS_COUNTER_LISTENERS,
+    STATS_COUNTER_LISTENER_CONNECTIONS,
+    STATS_COUNTER_CLIENT_CONNECTIONS,
+    STATS_COUNTER_FILE_CONNECTIONS,
+    STATS_COUNTER_STATS_CONNECTIONS,
+    STATS_COUNTER_SOURCE_CLIENT_CONNECTIONS,
+    STATS_COUNTER_SOURCE_RELAY_CONNECTIONS,
+    STATS_COUNTER_SOURCE_TOTAL_CONNECTIONS,
+    STATS_COUNTER_SLOW_LISTENERS,
+    STATS_COUNTER_BYTES_READ,
+    STATS_COUNTER_BYTES_SENT,
+    STATS_COUNTER_MAX
+} stats_counter_id;
+
+/* one block of counters, either the global one or one per source */
+typedef struct _stats_counters_tag
+{
+    int64_t value _Checked[STATS_COUNTER_MAX];
+    int64_t published _Checked[STATS_COUNTER_MAX];   /* as in the stats tree */
+    int64_t announced _Checked[STATS_COUNTER_MAX];   /* as last sent to stats listeners */
+    time_t announce_time;   /* when frequent counters are next sent */
+    char *mount : itype(_Nt_array_ptr<char>);
+
+    struct _stats_counters_tag *next : itype(_Ptr<struct _stats_counters_tag>);
+} stats_counters_t;
+
 void stats_initialize(void);
 void stats_shutdown(void);
 
@@ -87,12 +120,19 @@ void stats_event_add(const char *source : itype(_Nt_array_ptr<const char>), cons
 void stats_event_sub(const char *source : itype(_Nt_array_ptr<const char>), const char *name : itype(_Nt_array_ptr<const char>) , unsigned long value);
 void stats_event_dec(const char *source : itype(_Nt_array_ptr<const char>), const char *name : itype(_Nt_array_ptr<const char>) );
 void stats_event_hidden (const char *source : itype(_Nt_array_ptr<const char>), const char *name : itype(_Nt_array_ptr<const char>) , int hidden);
+void stats_counter_add (stats_counters_t *counters : itype(_Ptr<stats_counters_t>), stats_counter_id id, int64_t value);
+void stats_counter_set (stats_counters_t *counters : itype(_Ptr<stats_counters_t>), stats_counter_id id, int64_t value);
+void stats_counters_register (stats_counters_t *counters : itype(_Ptr<stats_counters_t>), char *mount : itype(_Nt_array_ptr<char>));
+void stats_counters_unregister (stats_counters_t *counters : itype(_Ptr<stats_counters_t>));
+void stats_counters_reset (stats_counters_t *counters : itype(_Ptr<stats_counters_t>));
 void stats_event_time (const char *mount : itype(_Nt_array_ptr<const char>), const char *name : itype(_Nt_array_ptr<const char>) );
 void stats_event_time_iso8601 (const char *mount : itype(_Nt_array_ptr<const char>), const char *name : itype(_Nt_array_ptr<const char>) );
 
 _Ptr<char> stats_connection(_Ptr<client_t> arg);
 void stats_callback (client_t *client : itype(_Ptr<client_t>), void *notused);
 
+void stats_send_metrics (client_t *client : itype(_Ptr<client_t>));
+void stats_send_json (client_t *client : itype(_Ptr<client_t>), const char *show_mount : itype(_Nt_array_ptr<const char>));
 void stats_transform_xslt(client_t *client : itype(_Ptr<client_t>), const char *uri : itype(_Nt_array_ptr<const char>));
 void stats_sendxml(client_t *client : itype(_Ptr<client_t>));
 xmlDocPtr stats_get_xml(int show_hidden, const char *show_mount : itype(_Nt_array_ptr<const char>)) : itype(_Ptr<xmlDoc>);
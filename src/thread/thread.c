@@ -520,9 +520,17 @@ void thread_cond_broadcast_c(cond_t *cond, int line, char *file)
 void thread_cond_timedwait_c(cond_t *cond, int millis, int line, char *file)
 {
     struct timespec time;
+    struct timeval now;
 
-    time.tv_sec = millis/1000;
-    time.tv_nsec = (millis - time.tv_sec*1000)*1000000;
+    /* pthread_cond_timedwait takes an absolute time */
+    gettimeofday (&now, NULL);
+    time.tv_sec = now.tv_sec + millis/1000;
+    time.tv_nsec = (now.tv_usec * 1000) + (millis % 1000) * 1000000;
+    if (time.tv_nsec >= 1000000000)
+    {
+        time.tv_sec++;
+        time.tv_nsec -= 1000000000;
+    }
 
     pthread_mutex_lock(&cond->cond_mutex);
     pthread_cond_timedwait(&cond->sys_cond, &cond->cond_mutex, &time);
@@ -536,6 +544,14 @@ void thread_cond_wait_c(cond_t *cond, int line, char *file)
     pthread_mutex_unlock(&cond->cond_mutex);
 }
 
+/* wait on cond with mutex, which the caller holds, rather than the cond's
+ * own mutex. The caller checks its condition under mutex, so a signal
+ * sent under that lock cannot be missed */
+void thread_cond_wait_mutex_c(cond_t *cond, mutex_t *mutex, int line, char *file)
+{
+    pthread_cond_wait(&cond->sys_cond, &mutex->sys_mutex);
+}
+
 void thread_rwlock_create_c(rwlock_t *rwlock, int line, char *file)
 {
     pthread_rwlock_init(&rwlock->sys_rwlock, NULL);
@@ -115,7 +115,8 @@ typedef mutex_t spin_t;
 #define thread_cond_signal(x) thread_cond_signal_c(x,__LINE__,__FILE__)
 #define thread_cond_broadcast(x) thread_cond_broadcast_c(x,__LINE__,__FILE__)
 #define thread_cond_wait(x) thread_cond_wait_c(x,__LINE__,__FILE__)
-#define thread_cond_timedwait(x,t) thread_cond_wait_c(x,t,__LINE__,__FILE__)
+#define thread_cond_timedwait(x,t) thread_cond_timedwait_c(x,t,__LINE__,__FILE__)
+#define thread_cond_wait_mutex(x,m) thread_cond_wait_mutex_c(x,m,__LINE__,__FILE__)
 #define thread_rwlock_create(x) thread_rwlock_create_c(x,__LINE__,__FILE__)
 #define thread_rwlock_rlock(x) thread_rwlock_rlock_c(x,__LINE__,__FILE__)
 #define thread_rwlock_wlock(x) thread_rwlock_wlock_c(x,__LINE__,__FILE__)
@@ -142,6 +143,7 @@ typedef mutex_t spin_t;
 # define thread_cond_broadcast_c _mangle(thread_cond_broadcast_c)
 # define thread_cond_wait_c _mangle(thread_cond_wait_c)
 # define thread_cond_timedwait_c _mangle(thread_cond_timedwait_c)
+# define thread_cond_wait_mutex_c _mangle(thread_cond_wait_mutex_c)
 # define thread_cond_destroy _mangle(thread_cond_destroy)
 # define thread_rwlock_create_c _mangle(thread_rwlock_create_c)
 # define thread_rwlock_rlock_c _mangle(thread_rwlock_rlock_c)
@@ -179,6 +181,7 @@ void thread_cond_signal_c(cond_t *cond : itype(_Ptr<cond_t>), int line, char *fi
 void thread_cond_broadcast_c(cond_t *cond : itype(_Ptr<cond_t>), int line, char *file : itype(_Ptr<char>));
 void thread_cond_wait_c(cond_t *cond : itype(_Ptr<cond_t>), int line, char *file : itype(_Ptr<char>));
 void thread_cond_timedwait_c(cond_t *cond : itype(_Ptr<cond_t>), int millis, int line, char *file : itype(_Ptr<char>));
+void thread_cond_wait_mutex_c(cond_t *cond : itype(_Ptr<cond_t>), mutex_t *mutex : itype(_Ptr<mutex_t>), int line, char *file : itype(_Ptr<char>));
 void thread_cond_destroy(cond_t *cond : itype(_Ptr<cond_t>));
 void thread_rwlock_create_c(rwlock_t *rwlock : itype(_Ptr<rwlock_t>), int line, char *file : itype(_Ptr<char>));
 void thread_rwlock_rlock_c(rwlock_t *rwlock : itype(_Ptr<rwlock_t>), int line, char *file : itype(_Ptr<char>));
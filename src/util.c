@@ -564,8 +564,10 @@ static char *_build_headers(int status, _Ptr<ice_config_t> config, _Ptr<source_t
     return ret;
 }
 
-ssize_t util_http_build_header(char *out : itype(_Nt_array_ptr<char>), size_t len, ssize_t offset, int cache, int status, const char *statusmsg : itype(_Nt_array_ptr<const char>), const char *contenttype : itype(_Nt_array_ptr<const char>), const char *charset : itype(_Nt_array_ptr<const char>) count(5), const char *datablock : itype(_Nt_array_ptr<const char>), struct source_tag *source : itype(_Ptr<struct source_tag>)) {
+ssize_t util_http_build_header(char *out : itype(_Nt_array_ptr<char>), size_t len, ssize_t offset, int cache, int status, const char *statusmsg : itype(_Nt_array_ptr<const char>), const char *contenttype : itype(_Nt_array_ptr<const char>), const char *charset : itype(_Nt_array_ptr<const char>) count(5), const char *datablock : itype(_Nt_array_ptr<const char>), struct source_tag *source : itype(_Ptr<struct source_tag>), struct _client_tag *client : itype(_Ptr<struct _client_tag>)) {
     _Nt_array_ptr<const char> http_version : byte_count(3) = "1.0";
+    _Nt_array_ptr<const char> connection_header = "Connection: Close\r\n";
+    char length_buffer _Nt_checked[40];
     _Ptr<ice_config_t> config = ((void *)0);
     time_t now;
     struct tm result;
@@ -637,12 +639,25 @@ ssize_t util_http_build_header(char *out : itype(_Nt_array_ptr<char>), size_t le
     else
         currenttime_buffer[0] = '\0';
 
+    length_buffer[0] = '\0';
+    if (client && client->keepalive != CLIENT_KEEPALIVE_NONE)
+    {
+        client->keepalive = CLIENT_KEEPALIVE_ACTIVE;
+        connection_header = "Connection: Keep-Alive\r\n";
+        if (status_buffer[0])
+            snprintf (status_buffer, sizeof (status_buffer), "HTTP/1.1 %d %s\r\n", status, statusmsg);
+        if (datablock)
+            snprintf (length_buffer, sizeof (length_buffer), "Content-Length: %lu\r\n", (unsigned long)strlen (datablock));
+    }
+
     config = config_get_config();
     extra_headers = ((_Nt_array_ptr<char> )_build_headers(status, config, source));
-    ret = snprintf (out, len, "%sServer: %s\r\nConnection: Close\r\n%s%s%s%s%s%s%s",
+    ret = snprintf (out, len, "%sServer: %s\r\n%s%s%s%s%s%s%s%s%s",
                               status_buffer,
 			      config->server_id,
+			      connection_header,
 			      currenttime_buffer,
+			      length_buffer,
 			      contenttype_buffer,
 			      (status == 401 ? "WWW-Authenticate: Basic realm=\"Icecast2 Server\"\r\n" : ""),
                               (cache     ? "" : "Cache-Control: no-cache, no-store\r\n"
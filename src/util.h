@@ -56,11 +56,15 @@ char *util_url_escape(const char *src : itype(_Nt_array_ptr<const char>)) : ityp
  * datablock is random data added to the request.
  * If datablock is non NULL the end-of-header is appended as well as this datablock.
  * If datablock is NULL no end-of-header nor any data is appended.
+ * client is only passed when the response length will be known to the
+ * client, either from a Content-Length the caller adds or from datablock
+ * which then gets one. If its request allows it the connection is kept open.
  * Returns the number of bytes written or -1 on error.
  */
 struct source_tag; /* use forward decleration so we do not need to
                     * include <source.h> that would cause other conflicts. */
-ssize_t util_http_build_header(char *out : itype(_Nt_array_ptr<char>), size_t len, ssize_t offset, int cache, int status, const char *statusmsg : itype(_Nt_array_ptr<const char>), const char *contenttype : itype(_Nt_array_ptr<const char>), const char *charset : itype(_Nt_array_ptr<const char>) count(5), const char *datablock : itype(_Nt_array_ptr<const char>), struct source_tag *source : itype(_Ptr<struct source_tag>));
+struct _client_tag;
+ssize_t util_http_build_header(char *out : itype(_Nt_array_ptr<char>), size_t len, ssize_t offset, int cache, int status, const char *statusmsg : itype(_Nt_array_ptr<const char>), const char *contenttype : itype(_Nt_array_ptr<const char>), const char *charset : itype(_Nt_array_ptr<const char>) count(5), const char *datablock : itype(_Nt_array_ptr<const char>), struct source_tag *source : itype(_Ptr<struct source_tag>), struct _client_tag *client : itype(_Ptr<struct _client_tag>));
 
 /* String dictionary type, without support for NULL keys, or multiple
  * instances of the same key */
@@ -244,7 +244,7 @@ void xslt_transform(xmlDocPtr doc : itype(_Ptr<xmlDoc>), const char *xslfilename
 
         if (string == NULL)
             string = xmlCharStrdup ("");
-        ret = util_http_build_header(refbuf->data, full_len, 0, 0, 200, NULL, _Assume_bounds_cast<_Nt_array_ptr<const char>>(mediatype, byte_count(0)), _Assume_bounds_cast<_Nt_array_ptr<const char>>(charset, count(5)), NULL, NULL);
+        ret = util_http_build_header(refbuf->data, full_len, 0, 0, 200, NULL, _Assume_bounds_cast<_Nt_array_ptr<const char>>(mediatype, byte_count(0)), _Assume_bounds_cast<_Nt_array_ptr<const char>>(charset, count(5)), NULL, NULL, client);
         if (ret == -1) {
             ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
             client_send_500(client, "Header generation failed.");
@@ -255,7 +255,7 @@ void xslt_transform(xmlDocPtr doc : itype(_Ptr<xmlDoc>), const char *xslfilename
                 if (new_data) {
                     ICECAST_LOG_DEBUG("Client buffer reallocation succeeded.");
                     refbuf->data = new_data, refbuf->len = full_len;
-                    ret = util_http_build_header(refbuf->data, full_len, 0, 0, 200, NULL, _Assume_bounds_cast<_Nt_array_ptr<const char>>(mediatype, byte_count(0)), _Assume_bounds_cast<_Nt_array_ptr<const char>>(charset, count(5)), NULL, NULL);
+                    ret = util_http_build_header(refbuf->data, full_len, 0, 0, 200, NULL, _Assume_bounds_cast<_Nt_array_ptr<const char>>(mediatype, byte_count(0)), _Assume_bounds_cast<_Nt_array_ptr<const char>>(charset, count(5)), NULL, NULL, client);
                     if (ret == -1) {
                         ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
                         client_send_500(client, "Header generation failed.");